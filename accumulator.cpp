@@ -0,0 +1,54 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <cassert>
+#include <algorithm>
+#include "accumulator.h"
+
+SpectrumAccumulator::SpectrumAccumulator(FrequencyTable * frequencyTable,
+                                         const std::vector<StepSpectrum> & stepSpectra,
+                                         std::string fileName)
+  : m_frequencyTable(frequencyTable),
+    m_stepCount(frequencyTable->GetFrequencyCount()),
+    m_stepSpectra(stepSpectra),
+    m_binCount(0)
+{
+  assert(stepSpectra.size() == this->m_stepCount);
+  for (auto & spectrum : stepSpectra) {
+    this->m_binCount = std::max(this->m_binCount, spectrum.m_binCount);
+  }
+  this->m_file = fopen(fileName.c_str(), "w");
+  if (this->m_file == nullptr) {
+    fprintf(stderr, "Failed to open file '%s'\n", fileName.c_str());
+    exit(1);
+  }
+}
+
+SpectrumAccumulator::~SpectrumAccumulator()
+{
+  fclose(this->m_file);
+}
+
+void SpectrumAccumulator::Update(uint32_t step, uint64_t sequenceId, const float * powers)
+{
+  assert(step < this->m_stepCount);
+  std::unique_lock<std::mutex> locker(this->m_mutex);
+  this->DoUpdate(step, sequenceId, powers);
+}
+
+void SpectrumAccumulator::WriteFrame(uint32_t step,
+                                     uint64_t sequenceId,
+                                     uint32_t count,
+                                     const void * data,
+                                     uint32_t size)
+{
+  FrameHeader header{step,
+                     this->m_stepSpectra[step].m_binCount,
+                     this->m_frequencyTable->GetFrequencyFromIndex(step),
+                     this->m_stepSpectra[step].m_binWidth,
+                     sequenceId,
+                     count,
+                     size};
+  fwrite(&header, sizeof(header), 1, this->m_file);
+  fwrite(data, size, 1, this->m_file);
+  fflush(this->m_file);
+}
@@ -0,0 +1,63 @@
+#pragma once
+
+#include <vector>
+#include <string>
+#include <mutex>
+#include <cstdint>
+#include <stdio.h>
+#include "frequencyTable.h"
+
+// Base of the spectrum accumulators that summarize the scan in the scanner
+// instead of shipping every spectrum. Each step of the frequency table gets
+// a slot of the bins of its spectrum, the used band from the lowest to the
+// highest frequency bin, which differ between the steps of frequency plan
+// segments with their own FFT size. Frames are appended to a binary file,
+// each a FrameHeader followed by the frame data.
+//
+class SpectrumAccumulator
+{
+ public:
+  struct FrameHeader
+  {
+    uint32_t m_step;
+    uint32_t m_binCount;
+    double m_frequency;
+    double m_binWidth;
+    uint64_t m_sequenceId;
+    uint32_t m_count;
+    uint32_t m_size;
+  };
+  // The spectrum of a step, binCount bins binWidth Hz apart.
+  struct StepSpectrum
+  {
+    uint32_t m_binCount;
+    double m_binWidth;
+  };
+
+ protected:
+  FrequencyTable * m_frequencyTable;
+  uint32_t m_stepCount;
+  std::vector<StepSpectrum> m_stepSpectra;
+  // The most bins of any step.
+  uint32_t m_binCount;
+  FILE * m_file;
+  std::mutex m_mutex;
+
+  void WriteFrame(uint32_t step, 
+                  uint64_t sequenceId, 
+                  uint32_t count, 
+                  const void * data, 
+                  uint32_t size);
+  virtual void DoUpdate(uint32_t step, uint64_t sequenceId, const float * powers) = 0;
+
+ public:
+  SpectrumAccumulator(FrequencyTable * frequencyTable,
+                      const std::vector<StepSpectrum> & stepSpectra,
+                      std::string fileName);
+  virtual ~SpectrumAccumulator();
+  // powers holds the linear power of each bin of the spectrum of the block
+  // captured at frequency table step.
+  void Update(uint32_t step, uint64_t sequenceId, const float * powers);
+  // Called once processing has ended.
+  virtual void Finish() {}
+};
@@ -33,8 +33,11 @@ AirspySource::AirspySource(std::string args,
                            uint32_t sampleRate, 
                            uint32_t sampleCount, 
                            double startFrequency, 
-                           double stopFrequency)
-  : SignalSource(sampleRate, sampleCount, startFrequency, stopFrequency),
+                           double stopFrequency,
+                           double useBandWidth,
+                           double tuneOffset,
+                           std::vector<FrequencyTable::Segment> segments)
+  : SignalSource(sampleRate, sampleCount, startFrequency, stopFrequency, useBandWidth, 0.0, tuneOffset, segments),
     m_dev(nullptr),
     m_streamingState(Illegal),
     m_bufferIndex(0),
@@ -170,6 +173,13 @@ double AirspySource::set_sample_rate( double rate )
   HANDLE_ERROR("Error setting sample rate: %%s\n");
 }
 
+// The fixed drop after a retune, in whole packets.
+//
+double AirspySource::GetMaxSettleTime()
+{
+  return ceil(this->m_sampleRate * m_retuneTime / 65536) * 65536 / this->m_sampleRate;
+}
+
 int AirspySource::_airspy_rx_callback(airspy_transfer* transfer)
 {
   AirspySource * obj = (AirspySource *)transfer->ctx;
@@ -185,17 +195,26 @@ int AirspySource::airspy_rx_callback(void * samples, int sample_count)
       this->m_dropPacketCount--;
       return 0;
     }
+    if (!this->IsSettled(reinterpret_cast<fftwf_complex *>(samples), uint32_t(sample_count))) {
+      return 0;
+    }
     double centerFrequency = this->GetCurrentFrequency();
+    uint32_t stepIndex = this->GetCurrentStepIndex();
     bool isScanStart = this->GetIsScanStart();
     startTime = time(NULL);
-    double nextFrequency = this->GetNextFrequency();
-    if (this->GetFrequencyCount() > 1) {
-      this->Retune(nextFrequency);
-      this->m_dropPacketCount = ceil(this->m_sampleRate * m_retuneTime / 65536);
+    if (this->DoRetune()) {
+      double nextFrequency = this->GetNextFrequency();
+      if (this->GetIsNewStep()) {
+        this->TimedRetune(nextFrequency);
+        if (this->m_settleDetector == nullptr) {
+          this->m_dropPacketCount = ceil(this->m_sampleRate * m_retuneTime / 65536);
+        }
+      }
     }
     for (uint32_t i = 0; i < sample_count/this->m_sampleCount; i++) {
       this->m_sampleQueue->AppendSamples(reinterpret_cast<fftwf_complex *>(samples) + i * this->m_sampleCount, 
                                          centerFrequency,
+                                         stepIndex,
                                          (isScanStart ? startTime : 0));
       isScanStart = false;
     }
@@ -219,7 +238,10 @@ bool AirspySource::GetNextSamples(SampleQueue * sampleQueue, double & centerFreq
   }
 
   if (this->GetFrequencyCount() > 1) {
-    this->Retune(this->GetNextFrequency());
+    double nextFrequency = this->GetNextFrequency();
+    if (this->GetIsNewStep()) {
+      this->TimedRetune(nextFrequency);
+    }
   }
   return true;
 }
@@ -242,7 +264,7 @@ void AirspySource::ThreadWorker()
 double AirspySource::Retune(double centerFrequency)
 {
   int status;
-  status = airspy_set_freq(this->m_dev, centerFrequency);
+  status = airspy_set_freq(this->m_dev, this->GetTunedFrequency(centerFrequency));
   HANDLE_ERROR("Failed to tune to %.0f Hz: %%s\n", 
                centerFrequency);
   return centerFrequency;
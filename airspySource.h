@@ -18,13 +18,17 @@ class AirspySource : public SignalSource
   static int _airspy_rx_callback(airspy_transfer* transfer);
   int airspy_rx_callback(void *samples, int sample_count);
   double set_sample_rate( double rate );
+  virtual double GetMaxSettleTime();
 
  public:
   AirspySource(std::string args,
                uint32_t sampleRate, 
                uint32_t sampleCount, 
                double startFrequency, 
-               double stopFrequency);
+               double stopFrequency,
+               double useBandWidth = 0.75,
+               double tuneOffset = 0.0,
+               std::vector<FrequencyTable::Segment> segments = std::vector<FrequencyTable::Segment>());
   virtual ~AirspySource();
   virtual bool GetNextSamples(SampleQueue * sampleQueue, double_t & centerFrequency);
   virtual bool StartStreaming(uint32_t numIterations, SampleQueue & sampleQueue);
@@ -16,9 +16,13 @@ B210Source::B210Source(std::string args,
                        uint32_t sampleRate, 
                        uint32_t sampleCount, 
                        double startFrequency, 
-                       double stopFrequency)
-  : SignalSource(sampleRate, sampleCount, startFrequency, stopFrequency),
-    m_verbose(false)
+                       double stopFrequency,
+                       double useBandWidth,
+                       double tuneOffset,
+                       std::vector<FrequencyTable::Segment> segments)
+  : SignalSource(sampleRate, sampleCount, startFrequency, stopFrequency, useBandWidth, 0.0, tuneOffset, segments),
+    m_verbose(false),
+    m_captureBuffer(new fftwf_complex[sampleCount])
 {
   //create a usrp device
   std::cout << std::endl;
@@ -71,29 +75,41 @@ B210Source::~B210Source()
 {
   //uhd_rx_streamer_free(&(*this->m_rx_stream));
   //uhd_usrp_free(&(*this->m_usrp));
+  delete [] this->m_captureBuffer;
 }
 
 double B210Source::Retune(double currentFrequency)
+{
+  this->StartTimer();
+  this->IssueTuneRequest(currentFrequency);
+  this->WaitForLock();
+  this->StopTimer();
+  this->AddRetuneTime();
+  if (this->m_verbose) {
+    std::cout << "Tuned to " << currentFrequency << std::endl;
+  }
+  return currentFrequency;
+}
+
+void B210Source::IssueTuneRequest(double currentFrequency)
 {
   //advanced tuning with tune_request_t uhd::tune_request_t
-  uhd::tune_request_t tune_req(currentFrequency, 0);
+  double tunedFrequency = this->GetTunedFrequency(currentFrequency);
+  uhd::tune_request_t tune_req(tunedFrequency, 0);
   tune_req.args = uhd::device_addr_t("mode_n=integer"); //to use Int-N tuning
   //fill in any additional/optional tune request fields...
   tune_req.dsp_freq_policy = uhd::tune_request_t::POLICY_AUTO;
-  tune_req.rf_freq = currentFrequency;
+  tune_req.rf_freq = tunedFrequency;
   tune_req.rf_freq_policy = uhd::tune_request_t::POLICY_MANUAL;
-  this->StartTimer();
   this->m_usrp->set_rx_freq(tune_req);
+}
+
+void B210Source::WaitForLock()
+{
   while (not this->m_usrp->get_rx_sensor("lo_locked").to_bool()) {
     //sleep for a short time in milliseconds
     std::this_thread::sleep_for(std::chrono::milliseconds(10));
   }
-  this->StopTimer();
-  this->AddRetuneTime();
-  if (this->m_verbose) {
-    std::cout << "Tuned to " << currentFrequency << std::endl;
-  }
-  return currentFrequency;
 }
 
 bool B210Source::GetNextSamples(SampleQueue * sampleQueue, double & centerFrequency)
@@ -143,7 +159,10 @@ bool B210Source::GetNextSamples(SampleQueue * sampleQueue, double & centerFreque
   }
 
   if (this->GetFrequencyCount() > 1) {
-    this->Retune(this->GetNextFrequency());
+    double nextFrequency = this->GetNextFrequency();
+    if (this->GetIsNewStep()) {
+      this->TimedRetune(nextFrequency);
+    }
   }
   if (nSamples < this->m_sampleCount) {
     std::cerr << "Receive timeout before all samples received..." << std::endl;
@@ -165,65 +184,71 @@ bool B210Source::StartStreaming(uint32_t numIterations, SampleQueue & sampleQueu
 
 void B210Source::ThreadWorker()
 {
-  while (!this->GetIsDone()) { 
-    // Set the centerFrequency.
-    double centerFrequency = this->GetCurrentFrequency();
-
-    //setup streaming
-    uhd::stream_cmd_t stream_cmd(uhd::stream_cmd_t::STREAM_MODE_NUM_SAMPS_AND_DONE);
-    stream_cmd.num_samps = this->m_sampleCount;
-    stream_cmd.stream_now = true;
-    stream_cmd.time_spec = uhd::time_spec_t(0.0);
-    this->m_rx_stream->issue_stream_cmd(stream_cmd);
-
-    std::vector<void *> buffs(1);
-    // int16_t sample_buffer[this->m_sampleCount][2];
-    fftwf_complex sample_buffer[this->m_sampleCount];
-    // meta-data will be filled in by recv()
-    uhd::rx_metadata_t md;
-    double timeout = 0.1; //timeout (delay before receive + padding)
-    uint32_t nSamples = 0; //number of accumulated samples
-
-    time_t startTime;
-    startTime = time(NULL);
-    while(nSamples < this->m_sampleCount) {
-      // setup the buffer.
-      buffs[0] = &sample_buffer[nSamples][0];
-      //receive a single packet
-      this->StartTimer();
-      size_t num_rx_samps = this->m_rx_stream->recv(buffs, 
-                                                    this->m_sampleCount - nSamples,
-                                                    md, 
-                                                    timeout, 
-                                                    true
-                                                    );
-
-      //handle the error code
-      if (md.error_code == uhd::rx_metadata_t::ERROR_CODE_TIMEOUT) break;
-      if (md.error_code != uhd::rx_metadata_t::ERROR_CODE_NONE){
-        throw std::runtime_error(str(boost::format("Receiver error %s"
-                                                   ) % md.strerror()));
-      }
-      this->StopTimer();
-      this->AddGetSamplesTime();
-      if (this->m_verbose) {
-        std::cout << boost::format(
-                                   "Received packet: %u samples, %u full secs, %f frac secs"
-                                   ) % num_rx_samps % md.time_spec.get_full_secs() % md.time_spec.get_frac_secs() << std::endl;
-      }
-      nSamples += num_rx_samps;
-    }
-    if (nSamples < this->m_sampleCount) {
-      std::cerr << "Receive timeout before all samples received..." << std::endl;
-      exit(1);
+  this->RunCaptureLoop();
+}
+
+bool B210Source::CaptureSamples()
+{
+  //setup streaming
+  uhd::stream_cmd_t stream_cmd(uhd::stream_cmd_t::STREAM_MODE_NUM_SAMPS_AND_DONE);
+  stream_cmd.num_samps = this->m_sampleCount;
+  stream_cmd.stream_now = true;
+  stream_cmd.time_spec = uhd::time_spec_t(0.0);
+  this->m_rx_stream->issue_stream_cmd(stream_cmd);
+
+  std::vector<void *> buffs(1);
+  // meta-data will be filled in by recv()
+  uhd::rx_metadata_t md;
+  double timeout = 0.1; //timeout (delay before receive + padding)
+  uint32_t nSamples = 0; //number of accumulated samples
+
+  while(nSamples < this->m_sampleCount) {
+    // setup the buffer.
+    buffs[0] = &this->m_captureBuffer[nSamples][0];
+    //receive a single packet
+    this->StartTimer();
+    size_t num_rx_samps = this->m_rx_stream->recv(buffs, 
+                                                  this->m_sampleCount - nSamples,
+                                                  md, 
+                                                  timeout, 
+                                                  true
+                                                  );
+
+    //handle the error code
+    if (md.error_code == uhd::rx_metadata_t::ERROR_CODE_TIMEOUT) break;
+    if (md.error_code != uhd::rx_metadata_t::ERROR_CODE_NONE){
+      throw std::runtime_error(str(boost::format("Receiver error %s"
+                                                 ) % md.strerror()));
     }
-    bool isScanStart = this->GetIsScanStart();
-    if (this->GetFrequencyCount() > 1 && this->DoRetune()) {
-      double nextFrequency = this->GetNextFrequency();
-      this->Retune(nextFrequency);
+    this->StopTimer();
+    this->AddGetSamplesTime();
+    if (this->m_verbose) {
+      std::cout << boost::format(
+                                 "Received packet: %u samples, %u full secs, %f frac secs"
+                                 ) % num_rx_samps % md.time_spec.get_full_secs() % md.time_spec.get_frac_secs() << std::endl;
     }
-    this->m_sampleQueue->AppendSamples(sample_buffer, 
-                                       centerFrequency, 
-                                       (isScanStart ? startTime : 0));
+    nSamples += num_rx_samps;
   }
+  if (nSamples < this->m_sampleCount) {
+    std::cerr << "Receive timeout before all samples received..." << std::endl;
+    exit(1);
+  }
+  return this->IsSettled(this->m_captureBuffer, this->m_sampleCount);
+}
+
+void B210Source::AppendCapture(double centerFrequency, uint32_t stepIndex, time_t time)
+{
+  this->m_sampleQueue->AppendSamples(this->m_captureBuffer, centerFrequency, stepIndex, time);
+}
+
+// The LO locks while the previous step is handed to the queue.
+//
+void B210Source::BeginRetune(double frequency)
+{
+  this->IssueTuneRequest(frequency);
+}
+
+void B210Source::FinishRetune()
+{
+  this->WaitForLock();
 }
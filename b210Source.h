@@ -9,6 +9,13 @@ class B210Source : public SignalSource
   double m_currentFrequency;
   double m_frequencyIncrement;
   bool m_verbose;
+  fftwf_complex * m_captureBuffer;
+  void IssueTuneRequest(double frequency);
+  void WaitForLock();
+  virtual bool CaptureSamples();
+  virtual void AppendCapture(double centerFrequency, uint32_t stepIndex, time_t time);
+  virtual void BeginRetune(double frequency);
+  virtual void FinishRetune();
 
  public:
   B210Source(std::string args,
@@ -16,7 +23,10 @@ class B210Source : public SignalSource
              uint32_t sampleRate, 
              uint32_t sampleCount, 
              double startFrequency, 
-             double stopFrequency);
+             double stopFrequency,
+             double useBandWidth = 0.75,
+             double tuneOffset = 0.0,
+             std::vector<FrequencyTable::Segment> segments = std::vector<FrequencyTable::Segment>());
   virtual ~B210Source();
   virtual bool GetNextSamples(SampleQueue * sampleQueue, double & centerFrequency);
   virtual bool StartStreaming(uint32_t numIterations, SampleQueue & sampleQueue);
@@ -15,6 +15,7 @@
 BladerfSource::~BladerfSource()
 {
   bladerf_close(this->m_dev);
+  delete [] this->m_captureBuffer;
 }
 
 int BladerfSource::configure_module(struct bladerf *dev, struct module_config *c)
@@ -91,7 +92,7 @@ bool BladerfSource::populate_quick_tunes()
   uint32_t count = this->m_frequencyTable.GetFrequencyCount();
   this->m_quickTunes = new struct bladerf_quick_tune[count];
   for (i = 0; i < count; i++) {
-    double frequency = this->m_frequencyTable.GetFrequencyFromIndex(i);
+    double frequency = this->GetTunedFrequency(this->m_frequencyTable.GetFrequencyFromIndex(i));
     status = bladerf_set_frequency(this->m_dev, BLADERF_MODULE_RX, frequency);
     HANDLE_ERROR("Failed to set frequency to %u Hz: %%s\n", frequency);
     status = bladerf_get_quick_tune(this->m_dev, BLADERF_MODULE_RX, &this->m_quickTunes[i]);
@@ -120,13 +121,18 @@ BladerfSource::BladerfSource(std::string args,
                              double startFrequency, 
                              double stopFrequency,
                              double useBandWidth,
-                             double dcIgnoreWidth)
+                             double dcIgnoreWidth,
+                             double tuneOffset,
+                             std::vector<FrequencyTable::Segment> segments)
   : SignalSource(sampleRate,
                  sampleCount,
                  startFrequency,
                  stopFrequency,
                  useBandWidth,
-                 dcIgnoreWidth)
+                 dcIgnoreWidth,
+                 tuneOffset,
+                 segments),
+    m_retuneTimestamp(0)
 {
   int status;
   struct module_config config;
@@ -184,6 +190,7 @@ BladerfSource::BladerfSource(std::string args,
                                0);
   
   bladerf_enable_module(this->m_dev, BLADERF_MODULE_RX, true);
+  this->m_captureBuffer = new int16_t[sampleCount][2];
   this->populate_quick_tunes();
   this->Retune(this->GetCurrentFrequency());
 }
@@ -195,6 +202,7 @@ bool BladerfSource::GetNextSamples(SampleQueue * sampleQueue, double & centerFre
   int16_t sample_buffer[this->m_sampleCount][2];
   
   centerFrequency = this->GetCurrentFrequency();
+  uint32_t stepIndex = this->GetCurrentStepIndex();
 
   /* Retrieve the current timestamp */
   struct bladerf_metadata metadata;
@@ -229,9 +237,12 @@ bool BladerfSource::GetNextSamples(SampleQueue * sampleQueue, double & centerFre
     }
   }
   if (this->GetFrequencyCount() > 1) {
-    this->Retune(this->GetNextFrequency());
+    double nextFrequency = this->GetNextFrequency();
+    if (this->GetIsNewStep()) {
+      this->TimedRetune(nextFrequency);
+    }
   }
-  this->m_sampleQueue->AppendSamples(sample_buffer, centerFrequency, 0);
+  this->m_sampleQueue->AppendSamples(sample_buffer, centerFrequency, stepIndex, 0);
   return true;
 }
 
@@ -244,61 +255,49 @@ bool BladerfSource::StartStreaming(uint32_t numIterations, SampleQueue & sampleQ
 void BladerfSource::ThreadWorker()
 {
   int status;
-  uint32_t delta = 100;
-  int16_t sample_buffer[this->m_sampleCount][2];
   /* Retrieve the current timestamp */
-  struct bladerf_metadata metadata;
-  memset(&metadata, 0, sizeof(metadata));
   status = bladerf_get_timestamp(this->m_dev, 
                                  BLADERF_MODULE_RX, 
-                                 &metadata.timestamp);
+                                 &this->m_retuneTimestamp);
   HANDLE_ERROR("Failed to get current RX timestamp: %s\n");
-  while (!this->GetIsDone()) { 
-    double centerFrequency = this->GetCurrentFrequency();
-    //fprintf(stderr, "Current RX timestamp: 0x%016lx ", metadata.timestamp);
-
-    /* Schedule the RX to be ~1 ms in the future */
-    struct bladerf_metadata metadata2;
-    memset(&metadata2, 0, sizeof(metadata2));
-    //metadata2.timestamp = metadata.timestamp; // + this->m_sampleRate/1000;
-    //fprintf(stderr, " 0x%016lx ", metadata2.timestamp);
-    metadata2.flags = BLADERF_META_FLAG_RX_NOW;
+  this->RunCaptureLoop();
+}
 
-    // TODO: How to convert metadata.timestamp to time_t
-    bool isScanStart = this->GetIsScanStart();
+bool BladerfSource::CaptureSamples()
+{
+  int status;
+  double centerFrequency = this->GetCurrentFrequency();
+  struct bladerf_metadata metadata;
+  memset(&metadata, 0, sizeof(metadata));
+  metadata.flags = BLADERF_META_FLAG_RX_NOW;
+  // Read until the samples are from after the retune.
+  do {
+    status = bladerf_sync_rx(this->m_dev,
+                             this->m_captureBuffer,
+                             this->m_sampleCount,
+                             &metadata,
+                             0);
+    HANDLE_ERROR("Failed to receive samples at %u Hz: %%s\n", centerFrequency);
+  } while (metadata.timestamp < this->m_retuneTimestamp);
+  return this->IsSettled(this->m_captureBuffer, this->m_sampleCount);
+}
 
-    // sleep(0.010);
-    //fprintf(stderr, "Tuned to %u\n", frequencies[j]);
-    /* ... Handle signals at current frequency ... */
-    while (true) {
-      status = bladerf_sync_rx(this->m_dev,
-                               sample_buffer,
-                               this->m_sampleCount,
-                               &metadata2,
-                               0);
-                             
-      //fprintf(stderr, " 0x%016lx\n", metadata2.timestamp);
-      HANDLE_ERROR("Failed to receive samples at %u Hz: %%s\n", centerFrequency);
-      if (metadata2.timestamp >= metadata.timestamp) {
-        break;
-      }
-    }
+void BladerfSource::AppendCapture(double centerFrequency, uint32_t stepIndex, time_t time)
+{
+  this->m_sampleQueue->AppendSamples(this->m_captureBuffer, centerFrequency, stepIndex, time);
+}
 
-    time_t startTime = time(NULL);
-    double nextFrequency = this->GetNextFrequency();
-    if (this->GetFrequencyCount() > 1) {
-      this->Retune(nextFrequency);
-    }
-    /* Retrieve the current timestamp */
-    status = bladerf_get_timestamp(this->m_dev, 
-                                   BLADERF_MODULE_RX, 
-                                   &metadata.timestamp);
-    HANDLE_ERROR("Failed to get current RX timestamp: %s\n");
-    this->m_sampleQueue->AppendSamples(sample_buffer, 
-                                       centerFrequency, 
-                                       (isScanStart ? startTime : 0));
-  }
-  return;
+// The quick tune is applied now; samples are taken from the device time of
+// the retune on.
+//
+void BladerfSource::BeginRetune(double frequency)
+{
+  int status;
+  this->Retune(frequency);
+  status = bladerf_get_timestamp(this->m_dev, 
+                                 BLADERF_MODULE_RX, 
+                                 &this->m_retuneTimestamp);
+  HANDLE_ERROR("Failed to get current RX timestamp: %s\n");
 }
 
 double BladerfSource::Retune(double frequency)
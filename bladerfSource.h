@@ -19,9 +19,15 @@ class BladerfSource : public SignalSource
 {
   struct bladerf * m_dev;
   struct bladerf_quick_tune * m_quickTunes;
+  int16_t (*m_captureBuffer)[2];
+  // Samples before this device time predate the last retune.
+  uint64_t m_retuneTimestamp;
   int configure_module(struct bladerf *dev, struct module_config *c);
   bool populate_quick_tunes();
   void handle_error(struct bladerf * dev, int status, const char * format, ...);
+  virtual bool CaptureSamples();
+  virtual void AppendCapture(double centerFrequency, uint32_t stepIndex, time_t time);
+  virtual void BeginRetune(double frequency);
 
  public:
   BladerfSource(std::string args,
@@ -30,7 +36,9 @@ class BladerfSource : public SignalSource
                 double startFrequency, 
                 double stopFrequency,
                 double useBandWidth,
-                double dcIgnoreWidth);
+                double dcIgnoreWidth,
+                double tuneOffset = 0.0,
+                std::vector<FrequencyTable::Segment> segments = std::vector<FrequencyTable::Segment>());
   virtual ~BladerfSource();
   virtual bool GetNextSamples(SampleQueue * sampleQueue, double_t & centerFrequency);
   virtual bool StartStreaming(uint32_t numIterations, SampleQueue & sampleQueue);
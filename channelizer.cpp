@@ -0,0 +1,133 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <math.h>
+#include <cassert>
+#include <gnuradio/filter/firdes.h>
+#include "channelizer.h"
+
+Channelizer::Channelizer(uint32_t channelCount,
+                         bool oversample,
+                         const std::vector<uint32_t> & channels)
+  : m_channelCount(channelCount),
+    m_decimation(oversample ? channelCount / 2 : channelCount),
+    m_channels(channels),
+    m_ifft(channelCount, FFTW_BACKWARD)
+{
+  assert(channelCount >= 2 && (channelCount % 2) == 0);
+  if (this->m_channels.empty()) {
+    for (uint32_t k = 0; k < channelCount; k++) {
+      this->m_channels.push_back(k);
+    }
+  }
+  for (auto channel : this->m_channels) {
+    if (channel >= channelCount) {
+      fprintf(stderr, "Channel %u out of range [0, %u)\n", channel, channelCount);
+      exit(1);
+    }
+  }
+  // Normalize the sample rate to channelCount so a channel is 1.0 wide. The
+  // oversampled output has room for a wider transition band.
+  double transitionWidth = oversample ? 0.4 : 0.2;
+  std::vector<float> prototype =
+    gr::filter::firdes::low_pass(1.0,
+                                 channelCount,
+                                 0.5,
+                                 transitionWidth,
+                                 gr::fft::window::WIN_BLACKMAN_HARRIS);
+  this->m_tapsPerBranch = (prototype.size() + channelCount - 1) / channelCount;
+  this->m_taps.assign(this->m_tapsPerBranch * channelCount, 0.0);
+  for (uint32_t i = 0; i < prototype.size(); i++) {
+    uint32_t p = i % channelCount;
+    uint32_t q = i / channelCount;
+    this->m_taps[p * this->m_tapsPerBranch + q] = prototype[i];
+  }
+  printf("Channelizer: %u channels, decimation %u, %u taps per branch\n",
+         channelCount,
+         this->m_decimation,
+         this->m_tapsPerBranch);
+}
+
+uint32_t Channelizer::GetChannelCount()
+{
+  return this->m_channelCount;
+}
+
+uint32_t Channelizer::GetSelectedCount()
+{
+  return this->m_channels.size();
+}
+
+uint32_t Channelizer::GetSelectedChannel(uint32_t index)
+{
+  assert(index < this->m_channels.size());
+  return this->m_channels[index];
+}
+
+uint32_t Channelizer::GetDecimation()
+{
+  return this->m_decimation;
+}
+
+uint32_t Channelizer::GetOutputCount(uint32_t sampleCount)
+{
+  if (sampleCount < this->m_channelCount) {
+    return 0;
+  }
+  return (sampleCount - this->m_channelCount) / this->m_decimation + 1;
+}
+
+// Channel k is centered at k * sampleRate / channelCount, where the upper
+// half of the channels are the negative frequencies.
+//
+double Channelizer::GetChannelOffset(uint32_t channel, uint32_t sampleRate)
+{
+  double width = double(sampleRate) / this->m_channelCount;
+  if (channel < this->m_channelCount / 2) {
+    return channel * width;
+  }
+  return (double(channel) - this->m_channelCount) * width;
+}
+
+// Channelize one block. Each block is filtered on its own, with the samples
+// before the block taken as zero, since consecutive blocks usually come from
+// different frequencies. workBuffer must hold 2 * channelCount fftw allocated
+// samples. output receives GetOutputCount() samples for each selected
+// channel, one channel after the other. Channel outputs are correct up to a
+// constant phase per channel.
+//
+void Channelizer::Process(const fftwf_complex * input,
+                          uint32_t sampleCount,
+                          fftwf_complex * workBuffer,
+                          fftwf_complex * output)
+{
+  uint32_t channelCount = this->m_channelCount;
+  uint32_t tapsPerBranch = this->m_tapsPerBranch;
+  uint32_t outputCount = this->GetOutputCount(sampleCount);
+  bool oversampled = this->m_decimation != channelCount;
+  fftwf_complex * branches = workBuffer;
+  fftwf_complex * spectrum = workBuffer + channelCount;
+  for (uint32_t m = 0; m < outputCount; m++) {
+    int64_t newest = int64_t(m) * this->m_decimation + channelCount - 1;
+    for (uint32_t p = 0; p < channelCount; p++) {
+      const float * taps = &this->m_taps[p * tapsPerBranch];
+      float re = 0.0;
+      float im = 0.0;
+      int64_t index = newest - p;
+      for (uint32_t q = 0; q < tapsPerBranch && index >= 0; q++, index -= channelCount) {
+        re += taps[q] * input[index][0];
+        im += taps[q] * input[index][1];
+      }
+      branches[p][0] = re;
+      branches[p][1] = im;
+    }
+    this->m_ifft.execute(spectrum, branches);
+    // With a hop of half the channel count the odd channels alternate sign.
+    bool flip = oversampled && (m & 1);
+    for (uint32_t c = 0; c < this->m_channels.size(); c++) {
+      uint32_t k = this->m_channels[c];
+      float sign = (flip && (k & 1)) ? -1.0 : 1.0;
+      output[c * outputCount + m][0] = sign * spectrum[k][0];
+      output[c * outputCount + m][1] = sign * spectrum[k][1];
+    }
+  }
+}
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+#include "fft.h"
+
+// Polyphase filterbank channelizer. Splits a block into channelCount equal
+// sub-channels, decimated by channelCount (critically sampled) or by
+// channelCount/2 (2x oversampled). The prototype low pass filter is designed
+// with the gnuradio filter library.
+//
+class Channelizer
+{
+  uint32_t m_channelCount;
+  uint32_t m_decimation;
+  uint32_t m_tapsPerBranch;
+  std::vector<uint32_t> m_channels;
+  // Polyphase taps, branch major: h[q * channelCount + p] is stored at
+  // m_taps[p * m_tapsPerBranch + q].
+  std::vector<float> m_taps;
+  FFT m_ifft;
+
+ public:
+  // Header written before each chunk of recorded channel samples.
+  struct RecordHeader
+  {
+    uint64_t m_sequenceId;
+    double m_frequency;
+    double m_sampleRate;
+    uint32_t m_channel;
+    uint32_t m_count;
+  };
+  Channelizer(uint32_t channelCount,
+              bool oversample,
+              const std::vector<uint32_t> & channels);
+  uint32_t GetChannelCount();
+  uint32_t GetSelectedCount();
+  uint32_t GetSelectedChannel(uint32_t index);
+  uint32_t GetDecimation();
+  uint32_t GetOutputCount(uint32_t sampleCount);
+  double GetChannelOffset(uint32_t channel, uint32_t sampleRate);
+  void Process(const fftwf_complex * input,
+               uint32_t sampleCount,
+               fftwf_complex * workBuffer,
+               fftwf_complex * output);
+};
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+
+// Bounded lock-free queue of commands from any number of producer threads
+// to a single consumer. Each cell carries a sequence number that tells
+// whose turn it is, so a producer claims a cell with one compare and swap
+// and the consumer never takes a lock. Push fails instead of waiting when
+// the channel is full, so producers never stall on the consumer.
+//
+template <typename T, uint32_t N>
+class CommandChannel
+{
+  static_assert(N > 0 && (N & (N - 1)) == 0, "The channel size must be a power of 2");
+  struct Cell
+  {
+    std::atomic<uint32_t> m_sequence;
+    T m_command;
+  };
+  Cell m_cells[N];
+  std::atomic<uint32_t> m_tail;
+  uint32_t m_head;
+
+ public:
+  CommandChannel()
+    : m_tail(0),
+      m_head(0)
+  {
+    for (uint32_t i = 0; i < N; i++) {
+      this->m_cells[i].m_sequence.store(i, std::memory_order_relaxed);
+    }
+  }
+
+  bool Push(const T & command)
+  {
+    uint32_t position = this->m_tail.load(std::memory_order_relaxed);
+    while (true) {
+      Cell & cell = this->m_cells[position % N];
+      uint32_t sequence = cell.m_sequence.load(std::memory_order_acquire);
+      int32_t difference = int32_t(sequence - position);
+      if (difference == 0) {
+        if (this->m_tail.compare_exchange_weak(position,
+                                               position + 1,
+                                               std::memory_order_relaxed)) {
+          cell.m_command = command;
+          cell.m_sequence.store(position + 1, std::memory_order_release);
+          return true;
+        }
+      } else if (difference < 0) {
+        return false;
+      } else {
+        position = this->m_tail.load(std::memory_order_relaxed);
+      }
+    }
+  }
+
+  // Only called from the consumer thread.
+  //
+  bool Pop(T & command)
+  {
+    Cell & cell = this->m_cells[this->m_head % N];
+    uint32_t sequence = cell.m_sequence.load(std::memory_order_acquire);
+    if (int32_t(sequence - (this->m_head + 1)) < 0) {
+      return false;
+    }
+    command = cell.m_command;
+    cell.m_sequence.store(this->m_head + N, std::memory_order_release);
+    this->m_head++;
+    return true;
+  }
+};
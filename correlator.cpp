@@ -0,0 +1,163 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <cassert>
+#include <algorithm>
+#include <volk/volk.h>
+#include "correlator.h"
+
+Correlator::Correlator(const std::vector<std::string> & fileNames, 
+                       float threshold, 
+                       uint32_t fftSize)
+  : m_threshold(threshold),
+    m_maxLength(0)
+{
+  for (auto & fileName : fileNames) {
+    // Templates are stored in the same raw format the scanner records.
+    FILE * inFile = fopen(fileName.c_str(), "r");
+    if (inFile == nullptr) {
+      fprintf(stderr, "Failed to open template file '%s'\n", fileName.c_str());
+      exit(1);
+    }
+    fseek(inFile, 0, SEEK_END);
+    uint32_t length = ftell(inFile) / sizeof(fftwf_complex);
+    fseek(inFile, 0, SEEK_SET);
+    if (length == 0) {
+      fprintf(stderr, "Template file '%s' is empty\n", fileName.c_str());
+      exit(1);
+    }
+    Template item{fileName, length, fftwf_alloc_complex(length), 0.0};
+    if (fread(item.m_samples, sizeof(fftwf_complex), length, inFile) != length) {
+      fprintf(stderr, "Failed to read template file '%s'\n", fileName.c_str());
+      exit(1);
+    }
+    fclose(inFile);
+    double energy = 0.0;
+    for (uint32_t i = 0; i < length; i++) {
+      energy += item.m_samples[i][0] * item.m_samples[i][0]
+        + item.m_samples[i][1] * item.m_samples[i][1];
+    }
+    if (energy == 0.0) {
+      fprintf(stderr, "Template file '%s' contains only zeros\n", fileName.c_str());
+      exit(1);
+    }
+    item.m_energy = energy;
+    this->m_maxLength = std::max(this->m_maxLength, length);
+    this->m_templates.push_back(item);
+    printf("Loaded template %s: %u samples\n", fileName.c_str(), length);
+  }
+  this->AddSpectra(fftSize);
+}
+
+Correlator::~Correlator()
+{
+  for (auto & item : this->m_templates) {
+    fftwf_free(item.m_samples);
+  }
+  for (auto & entry : this->m_spectraMap) {
+    for (auto spectrum : entry.second->m_spectra) {
+      fftwf_free(spectrum);
+    }
+    delete entry.second->m_inverseFFT;
+    delete entry.second;
+  }
+}
+
+uint32_t Correlator::GetTemplateCount()
+{
+  return this->m_templates.size();
+}
+
+const std::string & Correlator::GetTemplateName(uint32_t index)
+{
+  assert(index < this->m_templates.size());
+  return this->m_templates[index].m_fileName;
+}
+
+// Compute the template spectra and the inverse FFT plan for the FFT size.
+//
+void Correlator::AddSpectra(uint32_t fftSize)
+{
+  if (this->m_maxLength > fftSize) {
+    fprintf(stderr, "Template length %u exceeds FFT size %u\n", this->m_maxLength, fftSize);
+    exit(1);
+  }
+  Spectra * spectra = new Spectra;
+  spectra->m_inverseFFT = new FFT(fftSize, FFTW_BACKWARD);
+  FFT forwardFFT(fftSize);
+  fftwf_complex * padded = fftwf_alloc_complex(fftSize);
+  float scale = 1.0 / fftSize;
+  for (auto & item : this->m_templates) {
+    memset(padded, 0, sizeof(fftwf_complex) * fftSize);
+    memcpy(padded, item.m_samples, sizeof(fftwf_complex) * item.m_length);
+    fftwf_complex * spectrum = fftwf_alloc_complex(fftSize);
+    forwardFFT.execute(spectrum, padded);
+    // Conjugate for correlation and fold in the inverse FFT scaling.
+    for (uint32_t i = 0; i < fftSize; i++) {
+      spectrum[i][0] *= scale;
+      spectrum[i][1] *= -scale;
+    }
+    spectra->m_spectra.push_back(spectrum);
+  }
+  fftwf_free(padded);
+  this->m_spectraMap[fftSize] = spectra;
+}
+
+// Correlate a block against all templates. blockSpectrum is the unwindowed
+// FFT of block and workBuffer must hold 2 * fftSize fftw allocated samples.
+// Only lags where the template lies completely inside the block are
+// reported, since the remaining lags of the circular correlation wrap around.
+// The score is the normalized correlation, in the range [0, 1].
+//
+void Correlator::Correlate(fftwf_complex * blockSpectrum,
+                           const fftwf_complex * block,
+                           uint32_t fftSize,
+                           fftwf_complex * workBuffer,
+                           std::vector<Peak> & peaks)
+{
+  Spectra * spectra = this->m_spectraMap.at(fftSize);
+  fftwf_complex * product = workBuffer;
+  fftwf_complex * correlation = workBuffer + fftSize;
+  float power[fftSize];
+
+  // Prefix sums of the sample power give the block energy under any lag.
+  double energy[fftSize + 1];
+  energy[0] = 0.0;
+  for (uint32_t i = 0; i < fftSize; i++) {
+    energy[i + 1] = energy[i] + block[i][0] * block[i][0] + block[i][1] * block[i][1];
+  }
+
+  for (uint32_t t = 0; t < this->m_templates.size(); t++) {
+    Template & item = this->m_templates[t];
+    volk_32fc_x2_multiply_32fc(reinterpret_cast<lv_32fc_t *>(product),
+                               reinterpret_cast<lv_32fc_t *>(blockSpectrum),
+                               reinterpret_cast<lv_32fc_t *>(spectra->m_spectra[t]),
+                               fftSize);
+    spectra->m_inverseFFT->execute(correlation, product);
+    volk_32fc_magnitude_squared_32f(power,
+                                    reinterpret_cast<lv_32fc_t *>(correlation),
+                                    fftSize);
+    // Report the maximum of each run of lags above the threshold.
+    bool inPeak = false;
+    Peak best{t, 0, 0.0};
+    for (uint32_t n = 0; n + item.m_length <= fftSize; n++) {
+      double blockEnergy = energy[n + item.m_length] - energy[n];
+      float score = 0.0;
+      if (blockEnergy > 0.0) {
+        score = power[n] / (item.m_energy * blockEnergy);
+      }
+      if (score >= this->m_threshold) {
+        if (!inPeak || score > best.m_score) {
+          best = Peak{t, n, score};
+        }
+        inPeak = true;
+      } else if (inPeak) {
+        peaks.push_back(best);
+        inPeak = false;
+      }
+    }
+    if (inPeak) {
+      peaks.push_back(best);
+    }
+  }
+}
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <map>
+#include <string>
+#include <vector>
+#include "fft.h"
+
+// Matched filter detector. Each block is correlated against a set of known
+// complex templates (preambles) using fast convolution: the spectrum of the
+// block is multiplied by the precomputed conjugate template spectrum and
+// transformed back with one inverse FFT per template. The template spectra
+// and FFT plans for fftSize are made in the constructor, since the FFTW
+// planner must not run alongside the workers.
+//
+class Correlator
+{
+ public:
+  struct Peak
+  {
+    uint32_t m_templateIndex;
+    uint32_t m_offset;
+    float m_score;
+  };
+
+ private:
+  struct Template
+  {
+    std::string m_fileName;
+    uint32_t m_length;
+    fftwf_complex * m_samples;
+    float m_energy;
+  };
+  // Template spectra for one FFT size, conjugated and scaled by 1/size.
+  struct Spectra
+  {
+    FFT * m_inverseFFT;
+    std::vector<fftwf_complex *> m_spectra;
+  };
+  std::vector<Template> m_templates;
+  std::map<uint32_t, Spectra *> m_spectraMap;
+  float m_threshold;
+  uint32_t m_maxLength;
+  void AddSpectra(uint32_t fftSize);
+
+ public:
+  Correlator(const std::vector<std::string> & fileNames, float threshold, uint32_t fftSize);
+  ~Correlator();
+  uint32_t GetTemplateCount();
+  const std::string & GetTemplateName(uint32_t index);
+  void Correlate(fftwf_complex * blockSpectrum,
+                 const fftwf_complex * block,
+                 uint32_t fftSize,
+                 fftwf_complex * workBuffer,
+                 std::vector<Peak> & peaks);
+};
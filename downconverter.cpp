@@ -0,0 +1,152 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <math.h>
+#include <cassert>
+#include <gnuradio/filter/firdes.h>
+#include "downconverter.h"
+
+// A decimate-by-2 stage only has to keep aliases out of the final band of
+// +/- cutoff, so its transition band reaches from cutoff to the output rate
+// minus cutoff, which keeps the early stages short.
+//
+Downconverter::Stage::Stage(double inputRate, double cutoff)
+{
+  double outputRate = inputRate / 2;
+  assert(outputRate > 2 * cutoff);
+  std::vector<float> taps =
+    gr::filter::firdes::low_pass(1.0,
+                                 inputRate,
+                                 outputRate / 2,
+                                 outputRate - 2 * cutoff,
+                                 gr::fft::window::WIN_BLACKMAN_HARRIS);
+  // Reverse the taps so a dot product over the oldest first history is the
+  // convolution.
+  this->m_taps.assign(taps.rbegin(), taps.rend());
+  this->Reset();
+}
+
+void Downconverter::Stage::Reset()
+{
+  this->m_buffer.assign(this->m_taps.size() - 1, lv_32fc_t(0.0, 0.0));
+  this->m_next = this->m_taps.size() - 1;
+}
+
+uint32_t Downconverter::Stage::GetTapCount()
+{
+  return this->m_taps.size();
+}
+
+void Downconverter::Stage::Process(const lv_32fc_t * input,
+                                   uint32_t count,
+                                   std::vector<lv_32fc_t> & output)
+{
+  uint32_t tapCount = this->m_taps.size();
+  this->m_buffer.insert(this->m_buffer.end(), input, input + count);
+  output.clear();
+  uint32_t position = this->m_next;
+  for (; position < this->m_buffer.size(); position += 2) {
+    lv_32fc_t result;
+    volk_32fc_32f_dot_prod_32fc(&result,
+                                &this->m_buffer[position + 1 - tapCount],
+                                &this->m_taps[0],
+                                tapCount);
+    output.push_back(result);
+  }
+  // Keep the history needed by the next output.
+  uint32_t discard = this->m_buffer.size() - (tapCount - 1);
+  this->m_next = position - discard;
+  this->m_buffer.erase(this->m_buffer.begin(), this->m_buffer.begin() + discard);
+}
+
+Downconverter::Downconverter(double sampleRate, double offset, double bandWidth)
+  : m_phase(1.0, 0.0),
+    m_sampleRate(sampleRate),
+    m_offset(offset),
+    m_bandWidth(bandWidth),
+    m_decimation(1)
+{
+  double rate = sampleRate;
+  while (rate / 2 >= 2 * bandWidth) {
+    this->m_stages.push_back(Stage(rate, bandWidth / 2));
+    rate /= 2;
+    this->m_decimation *= 2;
+  }
+  this->Reset(offset);
+}
+
+void Downconverter::Reset(double offset)
+{
+  this->m_offset = offset;
+  double phaseIncrement = -2 * M_PI * offset / this->m_sampleRate;
+  this->m_phaseIncrement = lv_32fc_t(cos(phaseIncrement), sin(phaseIncrement));
+  this->m_phase = lv_32fc_t(1.0, 0.0);
+  for (auto & stage : this->m_stages) {
+    stage.Reset();
+  }
+}
+
+double Downconverter::GetOutputRate()
+{
+  return this->m_sampleRate / this->m_decimation;
+}
+
+double Downconverter::GetOffset()
+{
+  return this->m_offset;
+}
+
+uint32_t Downconverter::GetDecimation()
+{
+  return this->m_decimation;
+}
+
+// Each stage adds its history of taps - 1 inputs to the transient of its
+// input, and halves the sum.
+//
+uint32_t Downconverter::GetTransientCount()
+{
+  uint32_t transientCount = 0;
+  for (auto & stage : this->m_stages) {
+    transientCount = (transientCount + stage.GetTapCount()) / 2;
+  }
+  return transientCount;
+}
+
+void Downconverter::Process(const fftwf_complex * input,
+                            uint32_t count,
+                            std::vector<lv_32fc_t> & output)
+{
+  this->m_mixed.resize(count);
+  volk_32fc_s32fc_x2_rotator_32fc(&this->m_mixed[0],
+                                  reinterpret_cast<const lv_32fc_t *>(input),
+                                  this->m_phaseIncrement,
+                                  &this->m_phase,
+                                  count);
+  // Alternate between the two work buffers, the final stage output is small.
+  std::vector<lv_32fc_t> * current = &this->m_mixed;
+  std::vector<lv_32fc_t> * next = &this->m_scratch;
+  for (auto & stage : this->m_stages) {
+    stage.Process(&(*current)[0], current->size(), *next);
+    std::swap(current, next);
+  }
+  output.assign(current->begin(), current->end());
+}
+
+// Write the parameters needed to interpret a narrowband recording to a text
+// file next to it.
+//
+void Downconverter::WriteHeader(std::string fileName, double centerFrequency)
+{
+  FILE * outFile = fopen(fileName.c_str(), "w");
+  if (outFile == nullptr) {
+    fprintf(stderr, "Failed to open file '%s'\n", fileName.c_str());
+    return;
+  }
+  fprintf(outFile, "center_frequency %.0f\n", centerFrequency + this->m_offset);
+  fprintf(outFile, "tuned_frequency %.0f\n", centerFrequency);
+  fprintf(outFile, "offset %.0f\n", this->m_offset);
+  fprintf(outFile, "bandwidth %.0f\n", this->m_bandWidth);
+  fprintf(outFile, "sample_rate %.3f\n", this->GetOutputRate());
+  fprintf(outFile, "decimation %u\n", this->m_decimation);
+  fclose(outFile);
+}
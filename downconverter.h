@@ -0,0 +1,49 @@
+#pragma once
+
+#include <vector>
+#include <string>
+#include <cstdint>
+#include <volk/volk.h>
+#include "fft.h"
+
+// Digital down converter. Mixes a signal at offset Hz from the block center
+// down to baseband with a vectorized NCO and decimates it with a cascade of
+// decimate-by-2 FIR stages until the output rate is just above twice the
+// requested band width. The filter state is kept between calls, so
+// consecutive blocks of one capture are converted as a continuous stream.
+//
+class Downconverter
+{
+  class Stage
+  {
+    std::vector<float> m_taps;
+    std::vector<lv_32fc_t> m_buffer;
+    uint32_t m_next;
+   public:
+    Stage(double inputRate, double cutoff);
+    uint32_t GetTapCount();
+    void Reset();
+    void Process(const lv_32fc_t * input, uint32_t count, std::vector<lv_32fc_t> & output);
+  };
+  std::vector<Stage> m_stages;
+  std::vector<lv_32fc_t> m_mixed;
+  std::vector<lv_32fc_t> m_scratch;
+  lv_32fc_t m_phase;
+  lv_32fc_t m_phaseIncrement;
+  double m_sampleRate;
+  double m_offset;
+  double m_bandWidth;
+  uint32_t m_decimation;
+
+ public:
+  Downconverter(double sampleRate, double offset, double bandWidth);
+  // Start a new stream at offset Hz, keeping the filter design.
+  void Reset(double offset);
+  double GetOutputRate();
+  double GetOffset();
+  uint32_t GetDecimation();
+  // Leading output samples that depend on the zero filter history.
+  uint32_t GetTransientCount();
+  void Process(const fftwf_complex * input, uint32_t count, std::vector<lv_32fc_t> & output);
+  void WriteHeader(std::string fileName, double centerFrequency);
+};
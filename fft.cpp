@@ -1,13 +1,15 @@
 #include "fft.h"
 #include "string.h"
+#include <math.h>
+#include <volk/volk.h>
 
-FFT::FFT(int size)
+FFT::FFT(int size, int direction)
 {
     fftSize = size;
 
     fftwIn = (fftwf_complex*)fftwf_malloc(sizeof(fftwf_complex) * fftSize);
     fftwOut = (fftwf_complex*)fftwf_malloc(sizeof(fftwf_complex) * fftSize);
-    fftwPlan = fftwf_plan_dft_1d(fftSize, fftwIn, fftwOut, FFTW_FORWARD, FFTW_MEASURE);
+    fftwPlan = fftwf_plan_dft_1d(fftSize, fftwIn, fftwOut, direction, FFTW_MEASURE);
 }
 
 FFT::~FFT()
@@ -23,3 +25,75 @@ void FFT::process(void *dest, void *source)
     fftwf_execute(fftwPlan);
     memcpy(dest, fftwOut, fftSize * sizeof(fftwf_complex));
 }
+
+void FFT::execute(fftwf_complex *dest, fftwf_complex *source)
+{
+    fftwf_execute_dft(fftwPlan, source, dest);
+}
+
+PrunedFFT::PrunedFFT(int size, int first, int count, int radix)
+{
+    fftSize = size;
+    firstBin = first;
+    binCount = count;
+    this->radix = radix;
+    int subSize = size / radix;
+
+    // Sub-sequence p is x[p + radix*m]. Its transform is stored interleaved,
+    // Y_p[b] at b*radix + p, so the terms of one output bin are contiguous.
+    fftwf_complex *in = (fftwf_complex*)fftwf_malloc(sizeof(fftwf_complex) * fftSize);
+    fftwf_complex *out = (fftwf_complex*)fftwf_malloc(sizeof(fftwf_complex) * fftSize);
+    fftwPlan = fftwf_plan_many_dft(1, &subSize, radix,
+                                   in, NULL, radix, 1,
+                                   out, NULL, radix, 1,
+                                   FFTW_FORWARD, FFTW_MEASURE);
+    fftwf_free(in);
+    fftwf_free(out);
+
+    twiddles = (fftwf_complex*)fftwf_malloc(sizeof(fftwf_complex) * binCount * radix);
+    for (int w = 0; w < binCount; w++) {
+        int k = (firstBin + w) % fftSize;
+        for (int p = 0; p < radix; p++) {
+            double phase = -2 * M_PI * double(p) * k / fftSize;
+            twiddles[w * radix + p][0] = cos(phase);
+            twiddles[w * radix + p][1] = sin(phase);
+        }
+    }
+}
+
+PrunedFFT::~PrunedFFT()
+{
+    if (fftwPlan) fftwf_destroy_plan(fftwPlan);
+    if (twiddles) fftwf_free(twiddles);
+}
+
+void PrunedFFT::execute(fftwf_complex *dest, fftwf_complex *source, fftwf_complex *work)
+{
+    fftwf_execute_dft(fftwPlan, source, work);
+    int subSize = fftSize / radix;
+    int k = firstBin % fftSize;
+    for (int w = 0; w < binCount; w++) {
+        volk_32fc_x2_dot_prod_32fc(reinterpret_cast<lv_32fc_t*>(&dest[w]),
+                                   reinterpret_cast<lv_32fc_t*>(&work[(k % subSize) * radix]),
+                                   reinterpret_cast<lv_32fc_t*>(&twiddles[w * radix]),
+                                   radix);
+        if (++k == fftSize) k = 0;
+    }
+}
+
+// Rough flop counts: 5*n*log2(n) for an n point FFT, 8 per complex multiply
+// and add. Require a 10% gain before giving up the plain FFT.
+int PrunedFFT::chooseRadix(int size, int count)
+{
+    double fullCost = 5.0 * size * log2(size);
+    double bestCost = 0.9 * fullCost;
+    int best = 1;
+    for (int radix = 2; size % radix == 0 && size / radix >= 16; radix *= 2) {
+        double cost = 5.0 * size * log2(size / radix) + 8.0 * count * radix;
+        if (cost < bestCost) {
+            bestCost = cost;
+            best = radix;
+        }
+    }
+    return best;
+}
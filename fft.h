@@ -4,9 +4,12 @@
 
 class FFT {
 public:
-    FFT(int size);
+    FFT(int size, int direction = FFTW_FORWARD);
     ~FFT();
     void process(void *dest, void *source);
+    // Thread safe variant of process. Both buffers must be allocated
+    // with fftwf_malloc and must not alias.
+    void execute(fftwf_complex *dest, fftwf_complex *source);
     int getSize() { return fftSize; }
 
 private:
@@ -15,3 +18,33 @@ private:
     fftwf_complex *fftwOut = nullptr;
     fftwf_plan fftwPlan = nullptr;
 };
+
+// Output pruned FFT. Computes only the count bins starting at bin first,
+// modulo size, by decimation in time: the input is split into radix
+// interleaved sub-sequences that are transformed with size/radix point
+// FFTs, and each wanted bin is a radix term twiddled sum of those. This
+// costs about size*log2(size/radix) + count*radix operations instead of
+// size*log2(size), which pays when count is a small part of size.
+class PrunedFFT {
+public:
+    PrunedFFT(int size, int first, int count, int radix);
+    ~PrunedFFT();
+    // Thread safe. source and work must be allocated with fftwf_malloc,
+    // work holds size samples and dest receives count bins.
+    void execute(fftwf_complex *dest, fftwf_complex *source, fftwf_complex *work);
+    // The radix with the lowest estimated cost, 1 when the full FFT is
+    // cheaper.
+    static int chooseRadix(int size, int count);
+    int getSize() { return fftSize; }
+    int getCount() { return binCount; }
+    int getRadix() { return radix; }
+
+private:
+    int fftSize;
+    int firstBin;
+    int binCount;
+    int radix;
+    // radix twiddles for each wanted bin.
+    fftwf_complex *twiddles = nullptr;
+    fftwf_plan fftwPlan = nullptr;
+};
@@ -1,48 +1,280 @@
 #include <vector>
+#include <algorithm>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <cstdint>
 #include <math.h>
 #include <cassert>
 #include "frequencyTable.h"
+#include "scheduler.h"
 
 
+// Without segments the table is the single range startFrequency to
+// stopFrequency. Segments are compiled into one flat array of steps in
+// frequency order, so they must not overlap.
+//
 FrequencyTable::FrequencyTable(uint32_t sampleRate,
                                double startFrequency,
                                double stopFrequency,
                                double useBandWidth,
-                               double dcIgnoreWidth)
-  : m_frequencyIndex(0),
-    m_iterationCount(0)
-{
-  double f1 = startFrequency + useBandWidth/2 * sampleRate;
-  double step = useBandWidth; 
-  if (dcIgnoreWidth > 0) {
-    step = (useBandWidth - dcIgnoreWidth)/2;
-  }
-  double frequency;
-  uint32_t count = 0;
-  if (stopFrequency == 0.0) {
-    count = 1;
-  } else {
-    for (; (frequency = f1 + count * step * double(sampleRate)) < stopFrequency; count++) {
+                               double dcIgnoreWidth,
+                               std::vector<Segment> segments)
+  : m_segments(segments),
+    m_orderPosition(0),
+    m_frequencyIndex(0),
+    m_dwellCount(0),
+    m_isNewStep(false),
+    m_iterationCount(0),
+    m_scheduler(nullptr),
+    m_visitCount(0),
+    m_unvisitedCount(0),
+    m_isScanStart(false),
+    m_isHolding(false),
+    m_holdIndex(0),
+    m_holdCount(0),
+    m_resumeIndex(0),
+    m_resumeDwellCount(0)
+{
+  if (this->m_segments.empty()) {
+    this->m_segments.push_back(Segment{startFrequency, 
+                                       stopFrequency, 
+                                       useBandWidth, 
+                                       1, 
+                                       NAN, 
+                                       0,
+                                       {}});
+  }
+  std::sort(this->m_segments.begin(), 
+            this->m_segments.end(),
+            [](const Segment & a, const Segment & b) { 
+              return a.m_startFrequency < b.m_startFrequency; 
+            });
+  for (uint32_t index = 0; index < this->m_segments.size(); index++) {
+    Segment & segment = this->m_segments[index];
+    if (index > 0 && segment.m_startFrequency < this->m_segments[index - 1].m_stopFrequency) {
+      fprintf(stderr, "Frequency plan segments at %.0f and %.0f overlap\n",
+              this->m_segments[index - 1].m_startFrequency,
+              segment.m_startFrequency);
+      exit(1);
+    }
+    std::sort(segment.m_exclusions.begin(), segment.m_exclusions.end());
+    double halfUsed = segment.m_useBandWidth/2 * sampleRate;
+    double f1 = segment.m_startFrequency + halfUsed;
+    double step = segment.m_useBandWidth; 
+    if (dcIgnoreWidth > 0) {
+      step = (segment.m_useBandWidth - dcIgnoreWidth)/2;
+    }
+    double frequency;
+    uint32_t count = 0;
+    if (segment.m_stopFrequency == 0.0) {
+      count = 1;
+    } else {
+      for (; (frequency = f1 + count * step * double(sampleRate)) < segment.m_stopFrequency; count++) {
+      }
+      assert(count == ceil((segment.m_stopFrequency - f1)/(step * sampleRate)));
+    }
+    for (uint32_t i = 0; i < count; i++) {
+      double frequency = f1 + i * step * double(sampleRate);
+      // Walk the sorted exclusions to see whether they cover the used band.
+      double covered = frequency - halfUsed;
+      for (auto & exclusion : segment.m_exclusions) {
+        if (exclusion.first <= covered && exclusion.second > covered) {
+          covered = exclusion.second;
+        }
+      }
+      if (covered >= frequency + halfUsed) {
+        continue;
+      }
+      printf("Frequency %lu: %.0f\n", this->m_table.size(), frequency);
+      this->m_table.push_back(FrequencyInfo{frequency, nullptr, nullptr, index});
+    }
+  }
+  if (this->m_table.empty()) {
+    fprintf(stderr, "The frequency plan has no steps\n");
+    exit(1);
+  }
+}
+
+// A plan file has one segment or exclusion per line, '#' starts a comment:
+//   segment <start> <stop> [<use band width> [<dwell> [<threshold> [<fft size>]]]]
+//   exclude <start> <stop>
+// An exclusion applies to the segment before it. Missing fields take the
+// given defaults, a dwell of 1, the global threshold and FFT size.
+//
+std::vector<FrequencyTable::Segment> FrequencyTable::ReadPlan(std::string fileName,
+                                                              double useBandWidth,
+                                                              float threshold)
+{
+  std::vector<Segment> segments;
+  FILE * inFile = fopen(fileName.c_str(), "r");
+  if (inFile == nullptr) {
+    fprintf(stderr, "Failed to open frequency plan '%s'\n", fileName.c_str());
+    exit(1);
+  }
+  char line[256];
+  uint32_t lineNumber = 0;
+  while (fgets(line, sizeof(line), inFile) != nullptr) {
+    lineNumber++;
+    char * comment = strchr(line, '#');
+    if (comment != nullptr) {
+      *comment = '\0';
+    }
+    char keyword[16];
+    double start, stop;
+    double bandWidth = useBandWidth;
+    uint32_t dwell = 1;
+    float segmentThreshold = threshold;
+    uint32_t sampleCount = 0;
+    int count = sscanf(line, 
+                       "%15s %lf %lf %lf %u %f %u", 
+                       keyword, 
+                       &start, 
+                       &stop, 
+                       &bandWidth, 
+                       &dwell, 
+                       &segmentThreshold,
+                       &sampleCount);
+    if (count <= 0) {
+      continue;
+    }
+    bool valid = count >= 3 && start < stop;
+    if (valid && strcmp(keyword, "segment") == 0) {
+      valid = bandWidth > 0.0 && bandWidth <= 1.0 && dwell > 0;
+      segments.push_back(Segment{start, 
+                                 stop, 
+                                 bandWidth, 
+                                 dwell, 
+                                 segmentThreshold, 
+                                 sampleCount, 
+                                 {}});
+    } else if (valid && strcmp(keyword, "exclude") == 0 && count == 3) {
+      valid = !segments.empty();
+      if (valid) {
+        segments.back().m_exclusions.push_back(std::make_pair(start, stop));
+      }
+    } else {
+      valid = false;
+    }
+    if (!valid) {
+      fprintf(stderr, "%s:%u: bad frequency plan line\n", fileName.c_str(), lineNumber);
+      exit(1);
     }
-    assert(count == ceil((stopFrequency - f1)/(step * sampleRate)));
   }
-  this->m_table.resize(count);
-  for (uint32_t i = 0; i < count; i++) {
-    double frequency = f1 + i * step * double(sampleRate);
-    printf("Frequency %d: %.0f\n", i, frequency);
-    this->m_table.at(i) = FrequencyInfo{frequency, nullptr};
+  fclose(inFile);
+  return segments;
+}
+
+FrequencyTable::~FrequencyTable()
+{
+  delete this->m_scheduler;
+}
+
+// The scheduler takes over from the current step, which becomes its first
+// visit and the start of the first scan. The table deletes the scheduler.
+//
+void FrequencyTable::SetScheduler(SweepScheduler * scheduler)
+{
+  this->m_scheduler = scheduler;
+  this->m_frequencyIndex = scheduler->GetNextStep();
+  this->m_visitCount = 1;
+  this->m_visited.assign(this->m_table.size(), false);
+  this->m_visited[this->m_frequencyIndex] = true;
+  this->m_unvisitedCount = this->m_table.size() - 1;
+  this->m_isScanStart = true;
+}
+
+// Record a scheduler visit of the current step. The scheduler revisits
+// active steps, so a scan is over once every step has had a visit.
+//
+void FrequencyTable::VisitStep()
+{
+  this->m_isScanStart = this->m_unvisitedCount == 0;
+  if (this->m_isScanStart) {
+    this->m_visited.assign(this->m_table.size(), false);
+    this->m_unvisitedCount = this->m_table.size();
+  }
+  if (!this->m_visited[this->m_frequencyIndex]) {
+    this->m_visited[this->m_frequencyIndex] = true;
+    this->m_unvisitedCount--;
+  }
+}
+
+// order is a permutation of the step indices starting with step 0, so the
+// sweep still starts at the start of the table.
+//
+void FrequencyTable::SetOrder(const std::vector<uint32_t> & order)
+{
+  assert(order.size() == this->m_table.size() && order[0] == 0);
+  assert(this->m_orderPosition == 0);
+  this->m_order = order;
+}
+
+void FrequencyTable::ReportActivity(uint32_t index)
+{
+  if (this->m_scheduler != nullptr) {
+    this->m_scheduler->ReportActivity(index);
+  }
+}
+
+// Capture the step count more times before resuming the sweep where it
+// was interrupted. Holding another step moves the hold there; holding the
+// held step again extends it.
+//
+void FrequencyTable::HoldStep(uint32_t index, uint32_t count)
+{
+  assert(index < this->m_table.size());
+  if (!this->m_isHolding) {
+    this->m_isHolding = true;
+    this->m_resumeIndex = this->m_frequencyIndex;
+    this->m_resumeDwellCount = this->m_dwellCount;
   }
+  this->m_holdIndex = index;
+  this->m_holdCount = count;
 }
 
+// Stays at the current step until it has been captured its dwell count of
+// times. With a scheduler an iteration is as many visits as there are
+// steps. Held captures are outside the sweep and do not count.
+//
 double FrequencyTable::GetNextFrequency(void ** pinfo)
 {
-  this->m_frequencyIndex++;
-  if (this->m_frequencyIndex >= this->m_table.size()) {
-    this->m_frequencyIndex = 0;
-    this->m_iterationCount++;
+  uint32_t previousIndex = this->m_frequencyIndex;
+  this->m_isNewStep = false;
+  if (this->m_holdCount > 0) {
+    this->m_holdCount--;
+    this->m_frequencyIndex = this->m_holdIndex;
+    this->m_isNewStep = this->m_frequencyIndex != previousIndex;
+    return this->GetCurrentFrequency(pinfo);
+  }
+  if (this->m_isHolding) {
+    this->m_isHolding = false;
+    this->m_frequencyIndex = this->m_resumeIndex;
+    this->m_dwellCount = this->m_resumeDwellCount;
+  }
+  uint32_t dwell = this->m_segments[this->m_table[this->m_frequencyIndex].m_segment].m_dwell;
+  if (++this->m_dwellCount < dwell) {
+    this->m_isNewStep = this->m_frequencyIndex != previousIndex;
+    return this->GetCurrentFrequency(pinfo);
+  }
+  this->m_dwellCount = 0;
+  if (this->m_scheduler != nullptr) {
+    this->m_frequencyIndex = this->m_scheduler->GetNextStep();
+    this->VisitStep();
+    if (++this->m_visitCount % this->m_table.size() == 0) {
+      this->m_iterationCount++;
+    }
+  } else {
+    this->m_orderPosition++;
+    if (this->m_orderPosition >= this->m_table.size()) {
+      this->m_orderPosition = 0;
+      this->m_iterationCount++;
+    }
+    this->m_frequencyIndex = this->m_order.empty() 
+      ? this->m_orderPosition 
+      : this->m_order[this->m_orderPosition];
   }
+  this->m_isNewStep = this->m_frequencyIndex != previousIndex;
   return this->GetCurrentFrequency(pinfo);
 }
 
@@ -55,6 +287,19 @@ double FrequencyTable::GetCurrentFrequency(void ** pinfo)
   return finfo.m_frequency;
 }
 
+uint32_t FrequencyTable::GetCurrentIndex()
+{
+  return this->m_frequencyIndex;
+}
+
+// Whether the last GetNextFrequency moved to another step, which then has
+// to be tuned.
+//
+bool FrequencyTable::GetIsNewStep()
+{
+  return this->m_isNewStep;
+}
+
 double FrequencyTable::GetStartFrequency()
 {
   FrequencyInfo & finfo = this->m_table.front();
@@ -79,6 +324,33 @@ double FrequencyTable::GetFrequencyFromIndex(uint32_t index)
   return finfo.m_frequency;
 }
 
+// Index of the table frequency nearest to frequency.
+//
+uint32_t FrequencyTable::GetIndexFromFrequency(double frequency)
+{
+  uint32_t low = 0;
+  uint32_t high = this->m_table.size() - 1;
+  while (low < high) {
+    uint32_t middle = (low + high) / 2;
+    if (this->m_table[middle].m_frequency < frequency) {
+      low = middle + 1;
+    } else {
+      high = middle;
+    }
+  }
+  if (low > 0 
+      && frequency - this->m_table[low - 1].m_frequency < this->m_table[low].m_frequency - frequency) {
+    low--;
+  }
+  return low;
+}
+
+const FrequencyTable::Segment & FrequencyTable::GetSegmentFromIndex(uint32_t index)
+{
+  assert(index < this->m_table.size());
+  return this->m_segments[this->m_table[index].m_segment];
+}
+
 void FrequencyTable::SetFrequencyInfoForIndex(uint32_t index, void * info)
 {
   assert(index < this->m_table.size());
@@ -86,6 +358,18 @@ void FrequencyTable::SetFrequencyInfoForIndex(uint32_t index, void * info)
   finfo.m_info = info;
 }
 
+void FrequencyTable::SetProcessInfoForIndex(uint32_t index, void * info)
+{
+  assert(index < this->m_table.size());
+  this->m_table[index].m_processInfo = info;
+}
+
+void * FrequencyTable::GetProcessInfoForIndex(uint32_t index)
+{
+  assert(index < this->m_table.size());
+  return this->m_table[index].m_processInfo;
+}
+
 uint32_t FrequencyTable::GetIterationCount()
 {
   return this->m_iterationCount; 
@@ -93,5 +377,11 @@ uint32_t FrequencyTable::GetIterationCount()
 
 bool FrequencyTable::GetIsScanStart()
 {
+  if (this->m_isHolding || this->m_dwellCount != 0) {
+    return false;
+  }
+  if (this->m_scheduler != nullptr) {
+    return this->m_isScanStart;
+  }
   return this->m_frequencyIndex == 0;
 }
@@ -1,27 +1,91 @@
 #pragma once
 
+#include <vector>
+#include <string>
+#include <cstdint>
+
+class SweepScheduler;
+
 class FrequencyTable
 {
+ public:
+  // One range of a frequency plan. Steps whose used band lies entirely
+  // within the exclusions are not generated. A NaN threshold or a zero
+  // sample count leaves the global one in place.
+  struct Segment
+  {
+    double m_startFrequency;
+    double m_stopFrequency;
+    double m_useBandWidth;
+    // Captures per step.
+    uint32_t m_dwell;
+    float m_threshold;
+    // FFT size of the segment's steps.
+    uint32_t m_sampleCount;
+    std::vector<std::pair<double, double>> m_exclusions;
+  };
+
+ private:
   struct FrequencyInfo
   {
     double m_frequency;
     void * m_info;
+    // Processing descriptor of the step, owned by the processing side.
+    void * m_processInfo;
+    uint32_t m_segment;
   };
+  std::vector<Segment> m_segments;
   std::vector<FrequencyInfo> m_table;
+  // Sweep order of the steps when not the table order.
+  std::vector<uint32_t> m_order;
+  uint32_t m_orderPosition;
   uint32_t m_frequencyIndex;
+  // Captures made so far at the current step.
+  uint32_t m_dwellCount;
+  bool m_isNewStep;
   uint32_t m_iterationCount;
+  // Chooses the steps instead of the table order when set, owned.
+  SweepScheduler * m_scheduler;
+  uint64_t m_visitCount;
+  // With a scheduler a scan starts with the first visit after every step
+  // has been visited since the last start.
+  std::vector<bool> m_visited;
+  uint32_t m_unvisitedCount;
+  bool m_isScanStart;
+  // A step held outside the sweep, and the sweep position to resume at.
+  bool m_isHolding;
+  uint32_t m_holdIndex;
+  uint32_t m_holdCount;
+  uint32_t m_resumeIndex;
+  uint32_t m_resumeDwellCount;
+  void VisitStep();
 
  public:
   FrequencyTable(uint32_t m_sampleRate,
                  double m_startFrequency,
                  double m_stopFrequency,
                  double useBandWidth,
-                 double dcIgnoreWidth);
+                 double dcIgnoreWidth,
+                 std::vector<Segment> segments = std::vector<Segment>());
+  ~FrequencyTable();
+  static std::vector<Segment> ReadPlan(std::string fileName,
+                                       double useBandWidth,
+                                       float threshold);
+  void SetScheduler(SweepScheduler * scheduler);
+  void SetOrder(const std::vector<uint32_t> & order);
+  void ReportActivity(uint32_t index);
+  void HoldStep(uint32_t index, uint32_t count);
   double GetNextFrequency(void ** pinfo = nullptr);
   double GetCurrentFrequency(void ** pinfo = nullptr);
+  uint32_t GetCurrentIndex();
+  bool GetIsNewStep();
   uint32_t GetFrequencyCount();
   double GetFrequencyFromIndex(uint32_t index);
+  uint32_t GetIndexFromFrequency(double frequency);
+  const Segment & GetSegmentFromIndex(uint32_t index);
   void SetFrequencyInfoForIndex(uint32_t index, void * info);
+  void SetProcessInfoForIndex(uint32_t index, void * info);
+  void * GetProcessInfoForIndex(uint32_t index);
   uint32_t GetIterationCount();
   bool GetIsScanStart();
   double GetStartFrequency();
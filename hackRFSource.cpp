@@ -33,8 +33,11 @@ HackRFSource::HackRFSource(std::string args,
                            uint32_t sampleRate, 
                            uint32_t sampleCount, 
                            double startFrequency, 
-                           double stopFrequency)
-  : SignalSource(sampleRate, sampleCount, startFrequency, stopFrequency, 0.75, 0.0),
+                           double stopFrequency,
+                           double useBandWidth,
+                           double tuneOffset,
+                           std::vector<FrequencyTable::Segment> segments)
+  : SignalSource(sampleRate, sampleCount, startFrequency, stopFrequency, useBandWidth, 0.0, tuneOffset, segments),
     m_dev(nullptr),
     m_streamingState(Illegal),
     m_nextValidStreamTime{0, 0},
@@ -42,6 +45,7 @@ HackRFSource::HackRFSource(std::string args,
     m_dropPacketCount(0), // ceil(sampleRate * m_retuneTime / 131072)),
     m_scanStartCount(101),
     m_centerFrequency(1e12),
+    m_stepIndex(0),
     m_didRetune(false)
 {
   int status;
@@ -63,7 +67,10 @@ HackRFSource::HackRFSource(std::string args,
 
   this->set_sample_rate(sampleRate);
 
-  uint32_t bandWidth = hackrf_compute_baseband_filter_bw(uint32_t(0.75 * sampleRate));
+  // The filter passes the used band, wherever the tune offset puts it.
+  double halfUsed = useBandWidth * sampleRate / 2;
+  uint32_t bandWidth = 
+    hackrf_compute_baseband_filter_bw(uint32_t(std::max(0.75 * sampleRate, 2 * (fabs(tuneOffset) + halfUsed))));
   status = hackrf_set_baseband_filter_bandwidth( this->m_dev, bandWidth );
   HANDLE_ERROR("hackrf_set_baseband_filter_bandwidth %u: %%s", bandWidth );
 
@@ -103,12 +110,16 @@ HackRFSource::HackRFSource(std::string args,
   HANDLE_ERROR("Failed to set scan parameters: %%s\n");
 #endif
 
-  // Store scan parameters to use later.
+  // Store scan parameters to use later. The firmware sweep steps from the
+  // start MHz by the use band width and tunes each step offset Hz above its
+  // start, which is chosen to land the LO tune offset Hz below the step
+  // frequencies of the table.
   this->m_scanStartFrequency = uint16_t(startFrequency/1e6);
   this->m_scanStopFrequency = uint16_t(stopFrequency/1e6);
   this->m_scanNumBytes = sampleCount*2;
-  this->m_scanStepWidth = 0.75 * sampleRate;
-  this->m_scanOffset = this->m_scanStepWidth/2.0;
+  this->m_scanStepWidth = uint32_t(round(useBandWidth * sampleRate));
+  this->m_scanOffset = 
+    uint32_t(round(startFrequency - this->m_scanStartFrequency * 1e6 + halfUsed - tuneOffset));
 }
 
 HackRFSource::~HackRFSource()
@@ -218,7 +229,8 @@ double HackRFSource::interpolateSamples(hackrf_transfer* transfer)
     }
   }
   // printf("interpolateSamples: frequency[%f]\n", double(frequencyMhz) * 1e5);
-  return double(frequencyHz + this->m_scanOffset);
+  // The step frequency, tune offset Hz above the LO.
+  return double(frequencyHz + this->m_scanOffset) + this->m_tuneOffset;
 }
 
 int HackRFSource::hackRF_rx_callback(hackrf_transfer* transfer)
@@ -235,6 +247,7 @@ int HackRFSource::hackRF_rx_callback(hackrf_transfer* transfer)
       this->GetNextFrequency();
       isScanStart = this->GetIsScanStart();
       this->m_centerFrequency = centerFrequency;
+      this->m_stepIndex = this->GetStepIndex(centerFrequency);
       // this->m_dropPacketCount = 2;
       // return 0;
     }
@@ -260,6 +273,7 @@ int HackRFSource::hackRF_rx_callback(hackrf_transfer* transfer)
       //printf("hackRF_rx_callback appending[%d] frequency[%f]\n", i, centerFrequency);
       this->m_sampleQueue->AppendSamples(reinterpret_cast<int8_t (*)[2]>(&transfer->buffer[2*i]),
                                          centerFrequency,
+                                         this->m_stepIndex,
                                          startTime);
     }
   } else {
@@ -288,7 +302,10 @@ bool HackRFSource::GetNextSamples(SampleQueue * sampleQueue, double & centerFreq
   }
 
   if (this->GetFrequencyCount() > 1) {
-    this->Retune(this->GetNextFrequency());
+    double nextFrequency = this->GetNextFrequency();
+    if (this->GetIsNewStep()) {
+      this->TimedRetune(nextFrequency);
+    }
   }
   return true;
 }
@@ -335,7 +352,7 @@ double HackRFSource::Retune(double centerFrequency)
 {
   int status;
   // printf("Retuning to %.0f\n", centerFrequency);
-  status = hackrf_set_freq(this->m_dev, uint64_t(centerFrequency));
+  status = hackrf_set_freq(this->m_dev, uint64_t(this->GetTunedFrequency(centerFrequency)));
   HANDLE_ERROR("Failed to tune to %.0f Hz: %%s\n", 
                centerFrequency);
   // printf("Retuned to %.0f\n", centerFrequency);
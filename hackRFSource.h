@@ -16,6 +16,8 @@ class HackRFSource : public SignalSource
   uint32_t m_dropPacketCount;
   uint32_t m_scanStartCount;
   double m_centerFrequency;
+  // Step of m_centerFrequency, looked up when the sweep moves on.
+  uint32_t m_stepIndex;
   // New hackrf sweep parameters.
   uint16_t m_scanStartFrequency;
   uint16_t m_scanStopFrequency;
@@ -36,7 +38,10 @@ class HackRFSource : public SignalSource
                uint32_t sampleRate, 
                uint32_t sampleCount, 
                double startFrequency, 
-               double stopFrequency);
+               double stopFrequency,
+               double useBandWidth = 0.75,
+               double tuneOffset = 0.0,
+               std::vector<FrequencyTable::Segment> segments = std::vector<FrequencyTable::Segment>());
   virtual ~HackRFSource();
   virtual bool GetNextSamples(SampleQueue * sampleQueue, double_t & centerFrequency);
   virtual bool StartStreaming(uint32_t numIterations, SampleQueue & sampleQueue);
@@ -0,0 +1,77 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <math.h>
+#include <time.h>
+#include <cassert>
+#include <limits>
+#include <volk/volk.h>
+#include "histogramAccumulator.h"
+
+HistogramAccumulator::HistogramAccumulator(FrequencyTable * frequencyTable,
+                                           const std::vector<StepSpectrum> & stepSpectra,
+                                           std::string fileName,
+                                           uint32_t bucketCount,
+                                           float minimum,
+                                           float bucketWidth,
+                                           uint32_t interval)
+  : SpectrumAccumulator(frequencyTable, stepSpectra, fileName),
+    m_bucketCount(bucketCount),
+    m_minimum(minimum),
+    m_bucketWidth(bucketWidth),
+    m_interval(interval),
+    m_lastSnapshot(time(NULL))
+{
+  assert(bucketCount > 0 && bucketWidth > 0.0);
+  this->m_histograms.resize(this->m_stepCount);
+  for (uint32_t step = 0; step < this->m_stepCount; step++) {
+    Histogram & histogram = this->m_histograms[step];
+    histogram.m_counts.assign(stepSpectra[step].m_binCount * bucketCount, 0);
+    histogram.m_count = 0;
+  }
+  this->m_logPowers.resize(this->m_binCount);
+  this->m_buckets.resize(this->m_binCount);
+}
+
+void HistogramAccumulator::DoUpdate(uint32_t step, uint64_t sequenceId, const float * powers)
+{
+  Histogram & histogram = this->m_histograms[step];
+  uint32_t binCount = this->m_stepSpectra[step].m_binCount;
+  int32_t lastBucket = this->m_bucketCount - 1;
+  // 10 * log10(magnitude) is 5 * log10(2) * log2(power).
+  volk_32f_log2_32f(&this->m_logPowers[0], powers, binCount);
+  float scale = 5 * log10(2.0) / this->m_bucketWidth;
+  float offset = this->m_minimum / this->m_bucketWidth;
+  const float * logPowers = &this->m_logPowers[0];
+  int32_t * buckets = &this->m_buckets[0];
+  for (uint32_t i = 0; i < binCount; i++) {
+    float bucket = std::min(std::max(logPowers[i] * scale - offset, 0.0f), float(lastBucket));
+    buckets[i] = int32_t(bucket);
+  }
+  for (uint32_t i = 0; i < binCount; i++) {
+    uint16_t * counts = &histogram.m_counts[i * this->m_bucketCount];
+    if (counts[buckets[i]] == std::numeric_limits<uint16_t>::max()) {
+      for (uint32_t b = 0; b < this->m_bucketCount; b++) {
+        counts[b] /= 2;
+      }
+    }
+    counts[buckets[i]]++;
+  }
+  histogram.m_count++;
+  time_t now = time(NULL);
+  if (now - this->m_lastSnapshot >= this->m_interval) {
+    this->WriteSnapshot(sequenceId);
+    this->m_lastSnapshot = now;
+  }
+}
+
+void HistogramAccumulator::WriteSnapshot(uint64_t sequenceId)
+{
+  for (uint32_t step = 0; step < this->m_stepCount; step++) {
+    Histogram & histogram = this->m_histograms[step];
+    this->WriteFrame(step,
+                     sequenceId,
+                     histogram.m_count,
+                     &histogram.m_counts[0],
+                     sizeof(uint16_t) * histogram.m_counts.size());
+  }
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#include "accumulator.h"
+
+// Power histogram per bin of each step, the data behind a persistence
+// display. Buckets are bucketWidth dB wide from minimum dB up, in the
+// 10 * log10 magnitude units of the threshold, with powers outside the
+// range counted in the first or last bucket. When a bucket of a bin is
+// about to overflow all buckets of that bin are halved. A snapshot of all
+// steps, a frame per step with bucketCount uint16 counts for each bin, is
+// written every interval seconds.
+//
+class HistogramAccumulator : public SpectrumAccumulator
+{
+  struct Histogram
+  {
+    std::vector<uint16_t> m_counts;
+    uint32_t m_count;
+  };
+  std::vector<Histogram> m_histograms;
+  std::vector<float> m_logPowers;
+  std::vector<int32_t> m_buckets;
+  uint32_t m_bucketCount;
+  float m_minimum;
+  float m_bucketWidth;
+  uint32_t m_interval;
+  time_t m_lastSnapshot;
+
+  void DoUpdate(uint32_t step, uint64_t sequenceId, const float * powers);
+  void WriteSnapshot(uint64_t sequenceId);
+
+ public:
+  HistogramAccumulator(FrequencyTable * frequencyTable,
+                       const std::vector<StepSpectrum> & stepSpectra,
+                       std::string fileName,
+                       uint32_t bucketCount,
+                       float minimum,
+                       float bucketWidth,
+                       uint32_t interval);
+};
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <list>
+#include <map>
 #include <mutex>
 #include <condition_variable>
 
@@ -29,49 +30,68 @@ class Buffer
   }
 };
 
+// Buffers are kept in free lists by size class. Each class holds at most
+// bufferCount buffers, allocated when the class first needs them, so a
+// buffer is never released to make room for another size and a mix of
+// step sizes does not churn the heap. Allocate waits for a buffer of its
+// class once the class is at its limit.
+//
 template <class HeaderT, typename DataT>
 class MemoryPool 
 {
  public:
   typedef Buffer<HeaderT, DataT> BufferType;
  private:
+  uint32_t m_bufferSize;
   uint32_t m_bufferCount;
-  std::list<BufferType *> m_free;
+  std::map<uint32_t, uint32_t> m_allocatedCounts;
+  std::map<uint32_t, std::list<BufferType *>> m_free;
   std::mutex m_mutex;
   std::condition_variable m_conditionEmpty;
  public:
   MemoryPool(uint32_t bufferSize, uint32_t bufferCount)
-    : m_bufferCount(bufferCount),
+    : m_bufferSize(bufferSize),
+      m_bufferCount(bufferCount),
+      m_allocatedCounts(),
       m_free(),
       m_mutex()
       {
         for (uint32_t i = 0; i < bufferCount; i++) {
-          m_free.push_back(new BufferType(bufferSize));
+          m_free[bufferSize].push_back(new BufferType(bufferSize));
         }
+        m_allocatedCounts[bufferSize] = bufferCount;
       }
   ~MemoryPool() {
-    assert(this->m_free.size() == this->m_bufferCount);
-    while (!this->m_free.empty()) {
-      BufferType * element = this->m_free.front();
-      delete element;
-      this->m_free.pop_front();
+    for (auto & entry : this->m_free) {
+      assert(entry.second.size() == this->m_allocatedCounts[entry.first]);
+      while (!entry.second.empty()) {
+        BufferType * element = entry.second.front();
+        delete element;
+        entry.second.pop_front();
+      }
     }
   }
   BufferType * Allocate() {
+    return this->Allocate(this->m_bufferSize);
+  }
+  BufferType * Allocate(uint32_t bufferSize) {
     std::unique_lock<std::mutex> locker(this->m_mutex);
-    while (this->m_free.empty()) {
+    std::list<BufferType *> & free = this->m_free[bufferSize];
+    uint32_t & allocatedCount = this->m_allocatedCounts[bufferSize];
+    while (free.empty()) {
+      if (allocatedCount < this->m_bufferCount) {
+        allocatedCount++;
+        return new BufferType(bufferSize);
+      }
       this->m_conditionEmpty.wait(locker);
     }
-    BufferType * element = this->m_free.front();
-    this->m_free.pop_front();
+    BufferType * element = free.front();
+    free.pop_front();
     return element;
   }
   void Free(BufferType * element) {
     std::unique_lock<std::mutex> locker(this->m_mutex);
-    bool wasEmpty = this->m_free.empty();
-    this->m_free.push_back(element);
-    if (wasEmpty) {
-      this->m_conditionEmpty.notify_one();
-    }
+    this->m_free[element->m_bufferSize].push_back(element);
+    this->m_conditionEmpty.notify_all();
   }
 };
@@ -1,12 +1,15 @@
 #pragma once
 
 #include <vector>
+#include <map>
 #include <atomic>
 #include <thread>
+#include <set>
 #include <boost/circular_buffer.hpp>
 #include "fft.h"
 #include "utility.h"
 #include "memoryPool.h"
+#include "downconverter.h"
 
 template <typename T> 
 class MessageQueue
@@ -23,9 +26,19 @@ class MessageQueue
     } m_kind;
     uint32_t m_referenceCount;
     double m_frequency;
+    // Index of the frequency table step the samples were captured at.
+    uint32_t m_stepIndex;
+    // Samples in the message, the block size of the step.
+    uint32_t m_sampleCount;
     uint64_t m_sequenceId;
+    // Sequence id of the message before it at the same frequency, or
+    // s_noSequenceId for the first one.
+    uint64_t m_previousSequenceId;
     time_t m_time;
   };
+  // Step index of a write that is not limited to one step.
+  static const uint32_t s_allSteps = std::numeric_limits<uint32_t>::max();
+  static const uint64_t s_noSequenceId = std::numeric_limits<uint64_t>::max();
   typedef MemoryPool<MessageHeader, T> Allocator;
   typedef typename Allocator::BufferType MessageType;
   enum SampleKind {
@@ -48,21 +61,38 @@ class MessageQueue
   std::condition_variable m_conditionWriteEmpty;
   std::unique_ptr<std::thread> m_writeThread;
   FILE * m_writeFile;
+  Downconverter * m_downconverter;
+  std::vector<lv_32fc_t> m_downconverterOutput;
   uint64_t m_writeStartSequenceId;
   uint64_t m_writeEndSequenceId;
+  // Only blocks of this step are written, unless s_allSteps.
+  uint32_t m_writeStepIndex;
   bool m_doWrite;
   uint32_t m_iterationCount;
-  std::atomic<bool> m_acknowledged;
+  // Credit window of the source: it may retune while fewer than
+  // m_creditWindow blocks from the oldest unprocessed one on have been
+  // appended. Credits return per sequence id, in any order.
+  uint32_t m_creditWindow;
+  std::mutex m_creditMutex;
+  std::set<uint64_t> m_returnedCredits;
+  std::atomic<uint64_t> m_oldestUnprocessedId;
 
   // Not related to writing.
   fftwf_complex * m_floatComplex;
-  uint64_t m_nextBufferSequenceId;
+  std::atomic<uint64_t> m_nextBufferSequenceId;
+  // Sequence id of the last message appended at each frequency.
+  std::map<double, uint64_t> m_lastSequenceIds;
   uint32_t m_enob;
   uint32_t m_sampleCount;
+  // Block size of each frequency table step, when not m_sampleCount.
+  std::vector<uint32_t> m_stepSampleCounts;
   bool m_correctDCOffset;
   bool m_done;
   uint32_t enob;
-  void SynchronizedAppend(T * data, double centerFrequency, time_t time)
+  // A capture of a step with a smaller block size is split into
+  // consecutive messages of that size.
+  //
+  void SynchronizedAppend(T * data, double centerFrequency, uint32_t stepIndex, time_t time)
   {
     if (time) {
       this->m_iterationCount++;
@@ -70,24 +100,33 @@ class MessageQueue
     if (this->m_iterationCount < 2) {
       return;
     }
-    MessageType * message = this->m_memoryPool.Allocate();
-    memset(message->GetData(), 0, sizeof(T) * this->m_sampleCount);
-    memcpy(message->GetData(), data, sizeof(T) * this->m_sampleCount);
-    MessageHeader & header = message->GetHeader();
-    header.m_time = time;
-    header.m_frequency = centerFrequency;
-    header.m_kind = MessageHeader::ProcessData;
-    std::unique_lock<std::mutex> locker(this->m_mutex);
-    header.m_sequenceId = this->m_nextBufferSequenceId++;
-    while (this->IsFull()) {
-      this->m_conditionFull.wait(locker);
+    uint32_t sampleCount = this->m_sampleCount;
+    if (stepIndex < this->m_stepSampleCounts.size()) {
+      sampleCount = this->m_stepSampleCounts[stepIndex];
     }
-    bool wake = this->IsEmpty();
-    this->m_buffer.push_front(message);
-    if (wake) {
-      this->m_conditionEmpty.notify_one();
+    for (uint32_t offset = 0; offset + sampleCount <= this->m_sampleCount; offset += sampleCount) {
+      MessageType * message = this->m_memoryPool.Allocate(sampleCount);
+      memcpy(message->GetData(), data + offset, sizeof(T) * sampleCount);
+      MessageHeader & header = message->GetHeader();
+      header.m_time = offset == 0 ? time : 0;
+      header.m_frequency = centerFrequency;
+      header.m_stepIndex = stepIndex;
+      header.m_sampleCount = sampleCount;
+      header.m_kind = MessageHeader::ProcessData;
+      std::unique_lock<std::mutex> locker(this->m_mutex);
+      header.m_sequenceId = this->m_nextBufferSequenceId++;
+      auto last = this->m_lastSequenceIds.insert(std::make_pair(centerFrequency, s_noSequenceId)).first;
+      header.m_previousSequenceId = last->second;
+      last->second = header.m_sequenceId;
+      while (this->IsFull()) {
+        this->m_conditionFull.wait(locker);
+      }
+      bool wake = this->IsEmpty();
+      this->m_buffer.push_front(message);
+      if (wake) {
+        this->m_conditionEmpty.notify_one();
+      }
     }
-    this->ClearAck();
   }
   bool IsFull() {
     return this->m_buffer.full();
@@ -122,15 +161,32 @@ class MessageQueue
           }
           MessageType * message = *iter++;
           if (message->GetHeader().m_sequenceId < this->m_writeEndSequenceId) {
+            if (this->m_writeStepIndex != s_allSteps 
+                && message->GetHeader().m_stepIndex != this->m_writeStepIndex) {
+              continue;
+            }
             printf("Writing %lu\n", message->GetHeader().m_sequenceId);
             //memset(message->GetData(), 0, sizeof(fftwf_complex) * this->m_sampleCount);
-            fwrite(message->GetData(), 
-                   sizeof(fftwf_complex), 
-                   this->m_sampleCount, 
-                   this->m_writeFile);
+            if (this->m_downconverter != nullptr) {
+              this->m_downconverter->Process(message->GetData(),
+                                             message->GetHeader().m_sampleCount,
+                                             this->m_downconverterOutput);
+              fwrite(&this->m_downconverterOutput[0], 
+                     sizeof(lv_32fc_t), 
+                     this->m_downconverterOutput.size(), 
+                     this->m_writeFile);
+            } else {
+              fwrite(message->GetData(), 
+                     sizeof(fftwf_complex), 
+                     message->GetHeader().m_sampleCount, 
+                     this->m_writeFile);
+            }
           } else {
             assert(this->m_writeFile != nullptr);
             fclose(this->m_writeFile);
+            this->m_writeFile = nullptr;
+            delete this->m_downconverter;
+            this->m_downconverter = nullptr;
             done = true;
           }
         }
@@ -151,14 +207,17 @@ class MessageQueue
       m_enob(enob),
       m_kind(kind),
       m_done(false),
-      m_acknowledged(true),
+      m_creditWindow(0),
+      m_oldestUnprocessedId(0),
       m_nextBufferSequenceId(0),
       m_correctDCOffset(correctDCOffset),
       m_writeStartSequenceId(0),
       m_writeEndSequenceId(0),
+      m_writeStepIndex(s_allSteps),
       m_doWrite(doWrite),
       m_iterationCount(0),
-      m_writeFile(nullptr)
+      m_writeFile(nullptr),
+      m_downconverter(nullptr)
   {
     assert(kind > Illegal && kind <= FloatComplex);
     this->m_floatComplex = new fftwf_complex[sampleCount];
@@ -185,11 +244,13 @@ class MessageQueue
     if (this->m_writeFile != nullptr) {
       fclose(this->m_writeFile);
     }
+    delete this->m_downconverter;
   }
 
   void AppendSamples(int16_t * realSamples, 
                      int16_t * imagSamples, 
                      double centerFrequency,
+                     uint32_t stepIndex,
                      time_t time)
   {
     assert(this->m_kind == Short);
@@ -199,11 +260,12 @@ class MessageQueue
                                             this->m_sampleCount,
                                             this->m_enob,
                                             this->m_correctDCOffset);
-    this->SynchronizedAppend(this->m_floatComplex, centerFrequency, time);
+    this->SynchronizedAppend(this->m_floatComplex, centerFrequency, stepIndex, time);
   }
 
   void AppendSamples(int16_t shortComplexSamples[][2],
                      double centerFrequency,
+                     uint32_t stepIndex,
                      time_t time)
   {
     assert(this->m_kind == ShortComplex);
@@ -212,11 +274,12 @@ class MessageQueue
                                             this->m_sampleCount,
                                             this->m_enob,
                                             this->m_correctDCOffset);
-    this->SynchronizedAppend(this->m_floatComplex, centerFrequency, time);
+    this->SynchronizedAppend(this->m_floatComplex, centerFrequency, stepIndex, time);
   }
 
   void AppendSamples(int8_t (*byteComplexSamples)[2],
                      double centerFrequency,
+                     uint32_t stepIndex,
                      time_t time)
   {
     assert(this->m_kind == ByteComplex);
@@ -225,15 +288,26 @@ class MessageQueue
                                            this->m_sampleCount,
                                            this->m_enob,
                                            this->m_correctDCOffset);
-    this->SynchronizedAppend(this->m_floatComplex, centerFrequency, time);
+    this->SynchronizedAppend(this->m_floatComplex, centerFrequency, stepIndex, time);
   }
 
   void AppendSamples(fftwf_complex * floatComplexSamples,
                      double centerFrequency,
+                     uint32_t stepIndex,
                      time_t time)
   {
     assert(this->m_kind == FloatComplex);   
-    this->SynchronizedAppend(floatComplexSamples, centerFrequency, time);
+    this->SynchronizedAppend(floatComplexSamples, centerFrequency, stepIndex, time);
+  }
+
+  // Sizes must divide the capture size m_sampleCount.
+  //
+  void SetStepSampleCounts(const std::vector<uint32_t> & sampleCounts)
+  {
+    for (auto sampleCount : sampleCounts) {
+      assert(sampleCount > 0 && this->m_sampleCount % sampleCount == 0);
+    }
+    this->m_stepSampleCounts = sampleCounts;
   }
 
   MessageType * GetNextSamples()
@@ -262,6 +336,9 @@ class MessageQueue
     // MessageType * back = this->m_buffer.back();
     // assert(message->GetHeader().m_sequenceId == back->GetHeader().m_sequenceId);
     // std::unique_lock<std::mutex> locker(this->m_mutex);
+    if (this->m_creditWindow != 0) {
+      this->ReturnCredit(message->GetHeader().m_sequenceId);
+    }
     std::unique_lock<std::mutex> locker(this->m_writeMutex);
     if (this->m_writeBuffer.full()) {
       MessageType * message = this->m_writeBuffer.back();
@@ -272,10 +349,72 @@ class MessageQueue
     this->m_conditionWriteEmpty.notify_one();
   }
   
-  void BeginWrite(uint64_t startSequenceId, std::string fileName) {
+  // Copy up to count processed blocks that immediately precede sequenceId
+  // and were captured at frequency into output, oldest first. Returns the
+  // number of blocks copied.
+  //
+  uint32_t CopyPrecedingSamples(uint64_t sequenceId, 
+                                double frequency, 
+                                uint32_t count, 
+                                fftwf_complex * output) {
+    std::unique_lock<std::mutex> locker(this->m_writeMutex);
+    std::vector<MessageType *> messages;
+    for (uint64_t k = 1; k <= count && k <= sequenceId; k++) {
+      auto iter = std::find_if(this->m_writeBuffer.begin(), 
+                               this->m_writeBuffer.end(),
+                               [=](MessageType * & item) {
+                                 return (item->GetHeader().m_sequenceId == sequenceId - k);
+                               });
+      if (iter == this->m_writeBuffer.end() 
+          || (*iter)->GetHeader().m_frequency != frequency) {
+        break;
+      }
+      messages.push_back(*iter);
+    }
+    // Blocks captured at one frequency all have the same size.
+    for (uint32_t i = 0; i < messages.size(); i++) {
+      uint32_t sampleCount = messages[i]->GetHeader().m_sampleCount;
+      memcpy(output + i * sampleCount, 
+             messages[messages.size() - 1 - i]->GetData(),
+             sizeof(fftwf_complex) * sampleCount);
+    }
+    return messages.size();
+  }
+
+  // Sequence id of the earliest of up to count processed blocks of the step
+  // before sequenceId, or sequenceId when there are none. In a sweep they
+  // are spread over the earlier sweeps.
+  //
+  uint64_t GetPrecedingSequenceId(uint64_t sequenceId, uint32_t stepIndex, uint32_t count) {
+    std::unique_lock<std::mutex> locker(this->m_writeMutex);
+    uint64_t startSequenceId = sequenceId;
+    uint32_t found = 0;
+    for (auto iter = this->m_writeBuffer.begin(); 
+         iter != this->m_writeBuffer.end() && found < count; 
+         iter++) {
+      MessageHeader & header = (*iter)->GetHeader();
+      if (header.m_stepIndex == stepIndex && header.m_sequenceId < sequenceId) {
+        startSequenceId = std::min(startSequenceId, header.m_sequenceId);
+        found++;
+      }
+    }
+    return startSequenceId;
+  }
+
+  // When downconverter is given, the write thread takes ownership of it and
+  // writes its narrowband output instead of the full rate samples. With a
+  // stepIndex only the blocks of that step are written.
+  //
+  void BeginWrite(uint64_t startSequenceId, 
+                  std::string fileName, 
+                  Downconverter * downconverter = nullptr,
+                  uint32_t stepIndex = s_allSteps) {
     printf("BeginWrite %s: %lu\n", fileName.c_str(), startSequenceId);
     std::unique_lock<std::mutex> locker(this->m_writeMutex);
     this->m_writeFile = fopen(fileName.c_str(), "w");
+    delete this->m_downconverter;
+    this->m_downconverter = downconverter;
+    this->m_writeStepIndex = stepIndex;
     this->m_writeStartSequenceId = startSequenceId;
     this->m_writeEndSequenceId = std::numeric_limits<uint64_t>::max();
     this->m_conditionDoWrite.notify_one();
@@ -309,18 +448,29 @@ class MessageQueue
     return this->m_done;
   }
 
-  bool ReceivedAck() {
-    return this->m_acknowledged;
+  // A window of 0 never withholds credit.
+  //
+  void SetCreditWindow(uint32_t window) {
+    this->m_creditWindow = window;
   }
 
-  void SendAck() {
-    bool expected = false;
-    this->m_acknowledged.compare_exchange_strong(expected, true);
+  bool HasCredit() {
+    return this->m_creditWindow == 0 
+      || this->m_nextBufferSequenceId - this->m_oldestUnprocessedId < this->m_creditWindow;
   }
 
-  void ClearAck() {
-    bool expected = true;
-    this->m_acknowledged.compare_exchange_strong(expected, false);
+  void ReturnCredit(uint64_t sequenceId) {
+    std::unique_lock<std::mutex> locker(this->m_creditMutex);
+    if (sequenceId != this->m_oldestUnprocessedId) {
+      this->m_returnedCredits.insert(sequenceId);
+      return;
+    }
+    uint64_t oldestId = sequenceId + 1;
+    while (!this->m_returnedCredits.empty() && *this->m_returnedCredits.begin() == oldestId) {
+      this->m_returnedCredits.erase(this->m_returnedCredits.begin());
+      oldestId++;
+    }
+    this->m_oldestUnprocessedId = oldestId;
   }
 };
   
@@ -0,0 +1,205 @@
+#include <stdio.h>
+#include <string.h>
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <libairspy/airspy.h>
+#include "mockDevice.h"
+
+// Emulated libairspy. The library converts each USB transfer on its
+// consumer thread and calls back there, 65536 float IQ samples at a time;
+// here a thread of the device does the same, paced by the device clock,
+// and reports samples lost to a slow callback in dropped_samples.
+//
+
+static const uint32_t s_transferSamples = 65536;
+static const uint32_t s_sampleRates[] = { 10000000, 2500000 };
+
+struct airspy_device
+{
+  MockDevice m_device;
+  std::thread m_thread;
+  std::atomic<bool> m_streaming;
+  airspy_sample_block_cb_fn m_callback;
+  void * m_context;
+  airspy_sample_type m_sampleType;
+
+  airspy_device()
+    : m_device("airspy", 0.005, 0.001),
+      m_streaming(false),
+      m_callback(nullptr),
+      m_context(nullptr),
+      m_sampleType(AIRSPY_SAMPLE_FLOAT32_IQ)
+  {
+  }
+};
+
+static void StreamWorker(airspy_device * device)
+{
+  std::vector<MockDevice::Sample> samples(s_transferSamples);
+  airspy_transfer transfer;
+  transfer.device = device;
+  transfer.ctx = device->m_context;
+  transfer.samples = samples.data();
+  transfer.sample_count = s_transferSamples;
+  transfer.sample_type = device->m_sampleType;
+  uint64_t time;
+  while (device->m_streaming) {
+    device->m_device.Read(samples.data(), s_transferSamples, time);
+    transfer.dropped_samples = device->m_device.TakeDroppedSamples();
+    if (device->m_callback(&transfer) != 0) {
+      device->m_streaming = false;
+    }
+  }
+}
+
+extern "C" {
+
+const char* airspy_error_name(enum airspy_error errcode)
+{
+  switch (errcode) {
+  case AIRSPY_SUCCESS:
+    return "AIRSPY_SUCCESS";
+  case AIRSPY_ERROR_INVALID_PARAM:
+    return "AIRSPY_ERROR_INVALID_PARAM";
+  default:
+    return "AIRSPY_ERROR_OTHER";
+  }
+}
+
+int airspy_open(struct airspy_device** device)
+{
+  *device = new airspy_device;
+  return AIRSPY_SUCCESS;
+}
+
+int airspy_close(struct airspy_device* device)
+{
+  airspy_stop_rx(device);
+  delete device;
+  return AIRSPY_SUCCESS;
+}
+
+int airspy_board_id_read(struct airspy_device* device, uint8_t* value)
+{
+  *value = 0; // AIRSPY_BOARD_ID_PROTO_AIRSPY
+  return AIRSPY_SUCCESS;
+}
+
+int airspy_version_string_read(struct airspy_device* device, char* version, uint8_t length)
+{
+  snprintf(version, length, "mock");
+  return AIRSPY_SUCCESS;
+}
+
+// A len of 0 asks for the number of rates.
+//
+int airspy_get_samplerates(struct airspy_device* device, uint32_t* buffer, const uint32_t len)
+{
+  uint32_t count = sizeof(s_sampleRates) / sizeof(s_sampleRates[0]);
+  if (len == 0) {
+    *buffer = count;
+  } else if (len <= count) {
+    memcpy(buffer, s_sampleRates, len * sizeof(uint32_t));
+  } else {
+    return AIRSPY_ERROR_INVALID_PARAM;
+  }
+  return AIRSPY_SUCCESS;
+}
+
+// Small values are indices into the rates, as in the library.
+//
+int airspy_set_samplerate(struct airspy_device* device, uint32_t samplerate)
+{
+  uint32_t count = sizeof(s_sampleRates) / sizeof(s_sampleRates[0]);
+  if (samplerate < count) {
+    samplerate = s_sampleRates[samplerate];
+  }
+  device->m_device.SetSampleRate(samplerate);
+  return AIRSPY_SUCCESS;
+}
+
+int airspy_set_lna_agc(struct airspy_device* device, uint8_t value)
+{
+  return AIRSPY_SUCCESS;
+}
+
+int airspy_set_mixer_agc(struct airspy_device* device, uint8_t value)
+{
+  return AIRSPY_SUCCESS;
+}
+
+int airspy_set_lna_gain(struct airspy_device* device, uint8_t value)
+{
+  return AIRSPY_SUCCESS;
+}
+
+int airspy_set_mixer_gain(struct airspy_device* device, uint8_t value)
+{
+  return AIRSPY_SUCCESS;
+}
+
+int airspy_set_vga_gain(struct airspy_device* device, uint8_t value)
+{
+  return AIRSPY_SUCCESS;
+}
+
+int airspy_set_linearity_gain(struct airspy_device* device, uint8_t value)
+{
+  return value > 21 ? AIRSPY_ERROR_INVALID_PARAM : AIRSPY_SUCCESS;
+}
+
+int airspy_set_rf_bias(struct airspy_device* device, uint8_t value)
+{
+  return AIRSPY_SUCCESS;
+}
+
+int airspy_set_sample_type(struct airspy_device* device, enum airspy_sample_type sample_type)
+{
+  if (sample_type != AIRSPY_SAMPLE_FLOAT32_IQ) {
+    fprintf(stderr, "airspy mock: only AIRSPY_SAMPLE_FLOAT32_IQ is emulated\n");
+    return AIRSPY_ERROR_INVALID_PARAM;
+  }
+  device->m_sampleType = sample_type;
+  return AIRSPY_SUCCESS;
+}
+
+int airspy_set_freq(struct airspy_device* device, const uint32_t freq_hz)
+{
+  device->m_device.Tune(double(freq_hz), true);
+  return AIRSPY_SUCCESS;
+}
+
+int airspy_start_rx(struct airspy_device* device, airspy_sample_block_cb_fn callback, void* rx_ctx)
+{
+  if (device->m_streaming) {
+    return AIRSPY_ERROR_OTHER;
+  }
+  device->m_callback = callback;
+  device->m_context = rx_ctx;
+  device->m_device.SetBufferSamples(16 * s_transferSamples);
+  device->m_device.Start();
+  device->m_streaming = true;
+  device->m_thread = std::thread(StreamWorker, device);
+  return AIRSPY_SUCCESS;
+}
+
+int airspy_stop_rx(struct airspy_device* device)
+{
+  device->m_streaming = false;
+  if (device->m_thread.joinable()) {
+    if (device->m_thread.get_id() == std::this_thread::get_id()) {
+      device->m_thread.detach();
+    } else {
+      device->m_thread.join();
+    }
+  }
+  return AIRSPY_SUCCESS;
+}
+
+int airspy_is_streaming(struct airspy_device* device)
+{
+  return device->m_streaming;
+}
+
+}
@@ -0,0 +1,216 @@
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <vector>
+#include <libbladeRF.h>
+#include "mockDevice.h"
+
+// Emulated libbladeRF sync interface. bladerf_sync_rx blocks the calling
+// thread until the samples have arrived and stamps them with the device
+// sample counter that bladerf_get_timestamp reads. The RX module clock
+// starts when the module is enabled. Quick tunes carry an index into the
+// frequencies tuned so far in nfrac, in place of the LMS6002D PLL values,
+// and only the latest scheduled retune is kept.
+//
+
+static const int16_t s_fullScale = 2048;
+
+struct bladerf
+{
+  MockDevice m_device;
+  bool m_rxEnabled;
+  std::vector<double> m_quickTuneFrequencies;
+  std::vector<MockDevice::Sample> m_samples;
+
+  bladerf()
+    : m_device("bladerf", 0.0002, 0.0001),
+      m_rxEnabled(false)
+  {
+  }
+};
+
+extern "C" {
+
+const char * bladerf_strerror(int error)
+{
+  switch (error) {
+  case 0:
+    return "Success";
+  case BLADERF_ERR_INVAL:
+    return "Invalid operation or parameter";
+  default:
+    return "Unknown error code";
+  }
+}
+
+void bladerf_init_devinfo(struct bladerf_devinfo* info)
+{
+  memset(info, 0, sizeof(*info));
+}
+
+int bladerf_open_with_devinfo(struct bladerf** device, struct bladerf_devinfo* devinfo)
+{
+  *device = new struct bladerf;
+  return 0;
+}
+
+int bladerf_close(struct bladerf* dev)
+{
+  delete dev;
+  return 0;
+}
+
+int bladerf_set_frequency(struct bladerf* dev, bladerf_module module, unsigned int frequency)
+{
+  if (frequency < 237500000 || frequency > 3800000000u) {
+    return BLADERF_ERR_INVAL;
+  }
+  if (module == BLADERF_MODULE_RX) {
+    dev->m_device.Tune(double(frequency), true);
+  }
+  return 0;
+}
+
+int bladerf_set_sample_rate(struct bladerf* dev, bladerf_module module, unsigned int rate, unsigned int* actual)
+{
+  if (module == BLADERF_MODULE_RX) {
+    dev->m_device.SetSampleRate(rate);
+  }
+  if (actual != nullptr) {
+    *actual = rate;
+  }
+  return 0;
+}
+
+int bladerf_set_bandwidth(struct bladerf* dev, bladerf_module module, unsigned int bandwidth, unsigned int* actual)
+{
+  if (actual != nullptr) {
+    *actual = bandwidth;
+  }
+  return 0;
+}
+
+int bladerf_set_lna_gain(struct bladerf* dev, bladerf_lna_gain gain)
+{
+  return 0;
+}
+
+int bladerf_set_rxvga1(struct bladerf* dev, int gain)
+{
+  return 0;
+}
+
+int bladerf_set_rxvga2(struct bladerf* dev, int gain)
+{
+  return 0;
+}
+
+int bladerf_set_txvga1(struct bladerf* dev, int gain)
+{
+  return 0;
+}
+
+int bladerf_set_txvga2(struct bladerf* dev, int gain)
+{
+  return 0;
+}
+
+int bladerf_get_quick_tune(struct bladerf* dev, bladerf_module module, struct bladerf_quick_tune* quick_tune)
+{
+  memset(quick_tune, 0, sizeof(*quick_tune));
+  quick_tune->nfrac = dev->m_quickTuneFrequencies.size();
+  dev->m_quickTuneFrequencies.push_back(dev->m_device.GetFrequency());
+  return 0;
+}
+
+int bladerf_schedule_retune(struct bladerf* dev,
+                            bladerf_module module,
+                            uint64_t timestamp,
+                            unsigned int frequency,
+                            struct bladerf_quick_tune* quick_tune)
+{
+  double tuneFrequency = frequency;
+  if (quick_tune != nullptr) {
+    if (quick_tune->nfrac >= dev->m_quickTuneFrequencies.size()) {
+      return BLADERF_ERR_INVAL;
+    }
+    tuneFrequency = dev->m_quickTuneFrequencies[quick_tune->nfrac];
+  }
+  if (module == BLADERF_MODULE_RX) {
+    dev->m_device.TuneAt(tuneFrequency, timestamp);
+  }
+  return 0;
+}
+
+int bladerf_enable_module(struct bladerf* dev, bladerf_module module, bool enable)
+{
+  if (module == BLADERF_MODULE_RX) {
+    if (enable && !dev->m_rxEnabled) {
+      dev->m_device.Start();
+    }
+    dev->m_rxEnabled = enable;
+  }
+  return 0;
+}
+
+int bladerf_sync_config(struct bladerf* dev,
+                        bladerf_module module,
+                        bladerf_format format,
+                        unsigned int num_buffers,
+                        unsigned int buffer_size,
+                        unsigned int num_transfers,
+                        unsigned int stream_timeout)
+{
+  if (format != BLADERF_FORMAT_SC16_Q11_META || num_transfers > num_buffers || buffer_size % 1024 != 0) {
+    return BLADERF_ERR_INVAL;
+  }
+  if (module == BLADERF_MODULE_RX) {
+    dev->m_device.SetBufferSamples(uint64_t(num_buffers) * buffer_size);
+  }
+  return 0;
+}
+
+int bladerf_get_timestamp(struct bladerf* dev, bladerf_module module, uint64_t* value)
+{
+  *value = dev->m_device.GetDeviceTime();
+  return 0;
+}
+
+// Without BLADERF_META_FLAG_RX_NOW the samples up to the requested
+// timestamp are discarded first.
+//
+int bladerf_sync_rx(struct bladerf* dev,
+                    void* samples,
+                    unsigned int num_samples,
+                    struct bladerf_metadata* metadata,
+                    unsigned int timeout_ms)
+{
+  if (!dev->m_rxEnabled || metadata == nullptr) {
+    return BLADERF_ERR_INVAL;
+  }
+  dev->m_samples.resize(num_samples);
+  uint64_t time;
+  if (!(metadata->flags & BLADERF_META_FLAG_RX_NOW)) {
+    uint64_t streamTime = dev->m_device.GetStreamTime();
+    if (metadata->timestamp < streamTime) {
+      return BLADERF_ERR_INVAL;
+    }
+    while (streamTime < metadata->timestamp) {
+      uint32_t count = std::min(uint64_t(num_samples), metadata->timestamp - streamTime);
+      dev->m_device.Read(dev->m_samples.data(), count, time);
+      streamTime = time + count;
+    }
+  }
+  dev->m_device.Read(dev->m_samples.data(), num_samples, time);
+  int16_t * buffer = static_cast<int16_t *>(samples);
+  for (unsigned int i = 0; i < num_samples; i++) {
+    buffer[2*i] = MockToInt16(dev->m_samples[i].real(), s_fullScale);
+    buffer[2*i+1] = MockToInt16(dev->m_samples[i].imag(), s_fullScale);
+  }
+  metadata->timestamp = time;
+  metadata->actual_count = num_samples;
+  metadata->status = dev->m_device.TakeDroppedSamples() != 0 ? BLADERF_META_STATUS_OVERRUN : 0;
+  return 0;
+}
+
+}
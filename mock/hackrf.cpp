@@ -0,0 +1,291 @@
+#include <stdio.h>
+#include <string.h>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <libhackrf/hackrf.h>
+#include "mockDevice.h"
+
+// Emulated libhackrf. As with the library's libusb transfer thread, the
+// callback runs on a thread of its own with one transfer of 131072 int8 IQ
+// samples at a time, paced by the device clock. After hackrf_init_sweep the
+// stream switches to the firmware sweep: every 16384 byte block starts with
+// 0x7F 0x7F and the little-endian sweep frequency in Hz, and the firmware
+// retunes after each num_bytes, discarding the samples of the retune.
+//
+
+static const uint32_t s_transferBytes = 262144;
+static const uint32_t s_blockBytes = 16384;
+static const uint32_t s_headerBytes = 10;
+
+struct hackrf_device
+{
+  MockDevice m_device;
+  std::thread m_thread;
+  std::atomic<bool> m_streaming;
+  hackrf_sample_block_cb_fn m_callback;
+  void * m_context;
+  std::mutex m_sweepMutex;
+  bool m_sweeping;
+  std::vector<uint16_t> m_sweepRanges;
+  uint32_t m_sweepBytes;
+  uint32_t m_sweepStepWidth;
+  uint32_t m_sweepOffset;
+  uint32_t m_sweepRangeIndex;
+  uint64_t m_sweepFrequency;
+  uint32_t m_dwellBytes;
+
+  hackrf_device()
+    : m_device("hackrf", 0.001, 0.0005),
+      m_streaming(false),
+      m_callback(nullptr),
+      m_context(nullptr),
+      m_sweeping(false),
+      m_sweepBytes(0),
+      m_sweepStepWidth(0),
+      m_sweepOffset(0),
+      m_sweepRangeIndex(0),
+      m_sweepFrequency(0),
+      m_dwellBytes(0)
+  {
+  }
+};
+
+// Starts the next dwell of the sweep and writes the block header.
+//
+static void NextSweepBlock(hackrf_device * device, uint8_t * block)
+{
+  std::lock_guard<std::mutex> lock(device->m_sweepMutex);
+  if (device->m_dwellBytes == 0) {
+    if (device->m_sweepFrequency == 0) {
+      device->m_sweepRangeIndex = 0;
+      device->m_sweepFrequency = uint64_t(device->m_sweepRanges[0]) * 1000000;
+    } else {
+      device->m_sweepFrequency += device->m_sweepStepWidth;
+      if (device->m_sweepFrequency >= uint64_t(device->m_sweepRanges[2 * device->m_sweepRangeIndex + 1]) * 1000000) {
+        device->m_sweepRangeIndex = (device->m_sweepRangeIndex + 1) % (device->m_sweepRanges.size() / 2);
+        device->m_sweepFrequency = uint64_t(device->m_sweepRanges[2 * device->m_sweepRangeIndex]) * 1000000;
+      }
+    }
+    device->m_device.TakeTuneApplied();
+    device->m_device.Tune(double(device->m_sweepFrequency + device->m_sweepOffset), false);
+    device->m_dwellBytes = device->m_sweepBytes;
+  }
+  device->m_dwellBytes -= s_blockBytes;
+  block[0] = 0x7F;
+  block[1] = 0x7F;
+  for (uint32_t i = 0; i < 8; i++) {
+    block[2 + i] = uint8_t(device->m_sweepFrequency >> (8 * i));
+  }
+}
+
+static void StreamWorker(hackrf_device * device)
+{
+  uint32_t sampleCount = s_transferBytes / 2;
+  std::vector<MockDevice::Sample> samples(sampleCount);
+  std::vector<uint8_t> buffer(s_transferBytes);
+  hackrf_transfer transfer;
+  transfer.device = device;
+  transfer.buffer = buffer.data();
+  transfer.buffer_length = s_transferBytes;
+  transfer.valid_length = s_transferBytes;
+  transfer.rx_ctx = device->m_context;
+  transfer.tx_ctx = nullptr;
+  uint64_t time;
+  while (device->m_streaming) {
+    bool sweeping;
+    {
+      std::lock_guard<std::mutex> lock(device->m_sweepMutex);
+      sweeping = device->m_sweeping;
+    }
+    if (!sweeping) {
+      device->m_device.Read(samples.data(), sampleCount, time);
+      for (uint32_t i = 0; i < sampleCount; i++) {
+        buffer[2*i] = uint8_t(MockToInt8(samples[i].real()));
+        buffer[2*i+1] = uint8_t(MockToInt8(samples[i].imag()));
+      }
+    } else {
+      uint32_t blockSamples = s_blockBytes / 2;
+      for (uint32_t offset = 0; offset < s_transferBytes; offset += s_blockBytes) {
+        bool isDwellStart;
+        {
+          std::lock_guard<std::mutex> lock(device->m_sweepMutex);
+          isDwellStart = device->m_dwellBytes == 0;
+        }
+        uint8_t * block = &buffer[offset];
+        NextSweepBlock(device, block);
+        if (isDwellStart) {
+          // The firmware does not record while the tuner locks.
+          while (!device->m_device.TakeTuneApplied()) {
+            device->m_device.Read(samples.data(), blockSamples, time);
+          }
+        }
+        device->m_device.Read(samples.data(), blockSamples, time);
+        for (uint32_t i = s_headerBytes / 2; i < blockSamples; i++) {
+          block[2*i] = uint8_t(MockToInt8(samples[i].real()));
+          block[2*i+1] = uint8_t(MockToInt8(samples[i].imag()));
+        }
+      }
+    }
+    if (device->m_callback(&transfer) != 0) {
+      device->m_streaming = false;
+    }
+  }
+}
+
+extern "C" {
+
+const char* hackrf_error_name(enum hackrf_error errcode)
+{
+  switch (errcode) {
+  case HACKRF_SUCCESS:
+    return "HACKRF_SUCCESS";
+  case HACKRF_ERROR_INVALID_PARAM:
+    return "invalid parameter(s)";
+  default:
+    return "unspecified error";
+  }
+}
+
+int hackrf_init()
+{
+  return HACKRF_SUCCESS;
+}
+
+int hackrf_exit()
+{
+  return HACKRF_SUCCESS;
+}
+
+int hackrf_open(struct hackrf_device** device)
+{
+  *device = new hackrf_device;
+  return HACKRF_SUCCESS;
+}
+
+int hackrf_close(struct hackrf_device* device)
+{
+  hackrf_stop_rx(device);
+  delete device;
+  return HACKRF_SUCCESS;
+}
+
+int hackrf_board_id_read(struct hackrf_device* device, uint8_t* value)
+{
+  *value = 2; // HackRF One
+  return HACKRF_SUCCESS;
+}
+
+int hackrf_version_string_read(struct hackrf_device* device, char* version, uint8_t length)
+{
+  snprintf(version, length, "mock");
+  return HACKRF_SUCCESS;
+}
+
+int hackrf_set_sample_rate(struct hackrf_device* device, const double freq)
+{
+  device->m_device.SetSampleRate(freq);
+  return HACKRF_SUCCESS;
+}
+
+// The largest MAX2837 filter that is not wider than the request.
+//
+uint32_t hackrf_compute_baseband_filter_bw(const uint32_t bandwidth_hz)
+{
+  static const uint32_t bandwidths[] = {
+    1750000, 2500000, 3500000, 5000000, 5500000, 6000000, 7000000, 8000000,
+    9000000, 10000000, 12000000, 14000000, 15000000, 20000000, 24000000, 28000000
+  };
+  uint32_t result = bandwidths[0];
+  for (uint32_t bandwidth : bandwidths) {
+    if (bandwidth <= bandwidth_hz) {
+      result = bandwidth;
+    }
+  }
+  return result;
+}
+
+int hackrf_set_baseband_filter_bandwidth(struct hackrf_device* device, const uint32_t bandwidth_hz)
+{
+  return HACKRF_SUCCESS;
+}
+
+int hackrf_set_lna_gain(struct hackrf_device* device, uint32_t value)
+{
+  return value > 40 ? HACKRF_ERROR_INVALID_PARAM : HACKRF_SUCCESS;
+}
+
+int hackrf_set_vga_gain(struct hackrf_device* device, uint32_t value)
+{
+  return value > 62 ? HACKRF_ERROR_INVALID_PARAM : HACKRF_SUCCESS;
+}
+
+int hackrf_set_amp_enable(struct hackrf_device* device, const uint8_t value)
+{
+  return HACKRF_SUCCESS;
+}
+
+int hackrf_set_antenna_enable(struct hackrf_device* device, const uint8_t value)
+{
+  return HACKRF_SUCCESS;
+}
+
+int hackrf_set_freq(struct hackrf_device* device, const uint64_t freq_hz)
+{
+  device->m_device.Tune(double(freq_hz), true);
+  return HACKRF_SUCCESS;
+}
+
+int hackrf_start_rx(struct hackrf_device* device, hackrf_sample_block_cb_fn callback, void* rx_ctx)
+{
+  if (device->m_streaming) {
+    return HACKRF_ERROR_OTHER;
+  }
+  device->m_callback = callback;
+  device->m_context = rx_ctx;
+  device->m_device.SetBufferSamples(4 * s_transferBytes / 2);
+  device->m_device.Start();
+  device->m_streaming = true;
+  device->m_thread = std::thread(StreamWorker, device);
+  return HACKRF_SUCCESS;
+}
+
+int hackrf_stop_rx(struct hackrf_device* device)
+{
+  device->m_streaming = false;
+  if (device->m_thread.joinable()) {
+    if (device->m_thread.get_id() == std::this_thread::get_id()) {
+      device->m_thread.detach();
+    } else {
+      device->m_thread.join();
+    }
+  }
+  return HACKRF_SUCCESS;
+}
+
+// Both styles sweep linearly here.
+//
+int hackrf_init_sweep(struct hackrf_device* device,
+                      const uint16_t* frequency_list,
+                      const int num_ranges,
+                      const uint32_t num_bytes,
+                      const uint32_t step_width,
+                      const uint32_t offset,
+                      const enum sweep_style style)
+{
+  if (num_ranges < 1 || num_bytes == 0 || num_bytes % s_blockBytes != 0 || step_width == 0) {
+    return HACKRF_ERROR_INVALID_PARAM;
+  }
+  std::lock_guard<std::mutex> lock(device->m_sweepMutex);
+  device->m_sweepRanges.assign(frequency_list, frequency_list + 2 * num_ranges);
+  device->m_sweepBytes = num_bytes;
+  device->m_sweepStepWidth = step_width;
+  device->m_sweepOffset = offset;
+  device->m_sweepFrequency = 0;
+  device->m_dwellBytes = 0;
+  device->m_sweeping = true;
+  return HACKRF_SUCCESS;
+}
+
+}
@@ -0,0 +1,312 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <algorithm>
+#include <limits>
+#include <thread>
+#include "mockDevice.h"
+
+static const uint64_t s_noPendingTune = std::numeric_limits<uint64_t>::max();
+// Gaussian noise is drawn from a table; drawing it per sample would not
+// keep up with the higher sample rates.
+static const size_t s_noiseTableSize = 1 << 18;
+
+// Reads a time in microseconds from the environment.
+//
+static double GetEnvironmentTime(const char * name, double defaultTime)
+{
+  const char * value = getenv(name);
+  if (value == nullptr) {
+    return defaultTime;
+  }
+  return atof(value) / 1e6;
+}
+
+MockDevice::MockDevice(const char * name, double retuneLatency, double settleTime)
+  : m_name(name),
+    m_sampleRate(10e6),
+    m_retuneLatency(GetEnvironmentTime("SCAN_MOCK_RETUNE", retuneLatency)),
+    m_settleTime(GetEnvironmentTime("SCAN_MOCK_SETTLE", settleTime)),
+    m_paced(getenv("SCAN_MOCK_FAST") == nullptr),
+    m_bufferSamples(1 << 20),
+    m_startTime(std::chrono::steady_clock::now()),
+    m_streamTime(0),
+    m_frequency(100e6),
+    m_pendingFrequency(0.0),
+    m_pendingTime(s_noPendingTune),
+    m_tuneTime(0),
+    m_droppedSamples(0),
+    m_tuneApplied(false),
+    m_noiseTable(s_noiseTableSize),
+    m_replayIndex(0),
+    m_replayFrequency(0.0)
+{
+  this->Configure();
+}
+
+void MockDevice::Configure()
+{
+  const char * level = getenv("SCAN_MOCK_NOISE");
+  double noiseLevel = level != nullptr ? atof(level) : -60.0;
+  // Split the power between the two components.
+  float noiseAmplitude = pow(10.0, noiseLevel / 20) / sqrt(2.0);
+  std::normal_distribution<float> noise(0.0, noiseAmplitude);
+  for (Sample & sample : this->m_noiseTable) {
+    sample = Sample(noise(this->m_generator), noise(this->m_generator));
+  }
+
+  const char * tones = getenv("SCAN_MOCK_TONES");
+  if (tones != nullptr) {
+    std::string list(tones);
+    size_t position = 0;
+    while (position < list.size()) {
+      size_t end = list.find(',', position);
+      if (end == std::string::npos) {
+        end = list.size();
+      }
+      std::string tone = list.substr(position, end - position);
+      size_t colon = tone.find(':');
+      Tone value;
+      value.m_frequency = atof(tone.substr(0, colon).c_str());
+      double level = colon == std::string::npos ? -20.0 : atof(tone.substr(colon + 1).c_str());
+      value.m_amplitude = pow(10.0, level / 20);
+      this->m_tones.push_back(value);
+      position = end + 1;
+    }
+  }
+
+  const char * replay = getenv("SCAN_MOCK_REPLAY");
+  if (replay != nullptr) {
+    FILE * file = fopen(replay, "rb");
+    if (file == nullptr) {
+      fprintf(stderr, "%s mock: failed to open replay file %s\n", this->m_name.c_str(), replay);
+      exit(1);
+    }
+    float buffer[2 * 4096];
+    size_t count;
+    while ((count = fread(buffer, 2 * sizeof(float), 4096, file)) > 0) {
+      for (size_t i = 0; i < count; i++) {
+        this->m_replay.push_back(Sample(buffer[2*i], buffer[2*i+1]));
+      }
+    }
+    fclose(file);
+    if (this->m_replay.empty()) {
+      fprintf(stderr, "%s mock: replay file %s is empty\n", this->m_name.c_str(), replay);
+      exit(1);
+    }
+    const char * frequency = getenv("SCAN_MOCK_REPLAY_FREQUENCY");
+    if (frequency != nullptr) {
+      this->m_replayFrequency = atof(frequency);
+    }
+  }
+}
+
+void MockDevice::SetSampleRate(double sampleRate)
+{
+  std::lock_guard<std::mutex> lock(this->m_mutex);
+  this->m_sampleRate = sampleRate;
+}
+
+double MockDevice::GetSampleRate()
+{
+  return this->m_sampleRate;
+}
+
+void MockDevice::SetBufferSamples(uint64_t bufferSamples)
+{
+  std::lock_guard<std::mutex> lock(this->m_mutex);
+  this->m_bufferSamples = bufferSamples;
+}
+
+void MockDevice::Start()
+{
+  std::lock_guard<std::mutex> lock(this->m_mutex);
+  this->m_startTime = std::chrono::steady_clock::now();
+  this->m_streamTime = 0;
+  this->m_tuneTime = 0;
+  if (this->m_pendingTime != s_noPendingTune) {
+    this->m_pendingTime = 0;
+  }
+  this->m_droppedSamples = 0;
+}
+
+// Without pacing the device clock is the stream, so a reader is never late
+// and never waits.
+//
+uint64_t MockDevice::GetDeviceTime()
+{
+  if (!this->m_paced) {
+    return this->m_streamTime;
+  }
+  std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - this->m_startTime;
+  return uint64_t(elapsed.count() * this->m_sampleRate);
+}
+
+uint64_t MockDevice::GetStreamTime()
+{
+  return this->m_streamTime;
+}
+
+void MockDevice::Flush()
+{
+  std::lock_guard<std::mutex> lock(this->m_mutex);
+  this->m_streamTime = std::max(this->m_streamTime, this->GetDeviceTime());
+}
+
+// The synchronous tuner APIs return once the tuner has been programmed, so
+// with wait the caller sits out the latency there.
+//
+void MockDevice::Tune(double frequency, bool wait)
+{
+  {
+    std::lock_guard<std::mutex> lock(this->m_mutex);
+    this->m_pendingFrequency = frequency;
+    this->m_pendingTime = this->GetDeviceTime() + uint64_t(this->m_retuneLatency * this->m_sampleRate);
+  }
+  if (wait && this->m_paced) {
+    std::this_thread::sleep_for(std::chrono::microseconds(uint64_t(1e6 * this->m_retuneLatency)));
+  }
+}
+
+// A tune scheduled for a device time replaces any still pending.
+//
+void MockDevice::TuneAt(double frequency, uint64_t time)
+{
+  std::lock_guard<std::mutex> lock(this->m_mutex);
+  this->m_pendingFrequency = frequency;
+  this->m_pendingTime = std::max(time, this->GetDeviceTime())
+    + uint64_t(this->m_retuneLatency * this->m_sampleRate);
+}
+
+double MockDevice::GetFrequency()
+{
+  std::lock_guard<std::mutex> lock(this->m_mutex);
+  return this->m_pendingTime != s_noPendingTune ? this->m_pendingFrequency : this->m_frequency;
+}
+
+void MockDevice::ApplyPendingTune(uint64_t time)
+{
+  if (time >= this->m_pendingTime) {
+    this->m_frequency = this->m_pendingFrequency;
+    this->m_tuneTime = time;
+    this->m_pendingTime = s_noPendingTune;
+    this->m_tuneApplied = true;
+  }
+}
+
+// Noise from the table at a random start, then either the replay or the
+// tones within the passband, then the linearly decaying DC offset of a
+// tuner that has not yet settled. The frequency is constant over the span,
+// so the carriers are rotated by a fixed step from sample to sample.
+//
+void MockDevice::GenerateSpan(Sample * samples, uint64_t time, uint32_t count)
+{
+  size_t noiseIndex = this->m_generator() % this->m_noiseTable.size();
+  for (uint32_t i = 0; i < count; i++) {
+    samples[i] = this->m_noiseTable[noiseIndex];
+    noiseIndex = (noiseIndex + 1) % this->m_noiseTable.size();
+  }
+  double seconds = time / this->m_sampleRate;
+  if (!this->m_replay.empty()) {
+    double offset = this->m_replayFrequency != 0.0 ? this->m_replayFrequency - this->m_frequency : 0.0;
+    bool isAudible = fabs(offset) < this->m_sampleRate / 2.0;
+    Sample phase = std::polar(1.0f, float(fmod(2 * M_PI * offset * seconds, 2 * M_PI)));
+    Sample step = std::polar(1.0f, float(2 * M_PI * offset / this->m_sampleRate));
+    for (uint32_t i = 0; i < count; i++) {
+      if (isAudible) {
+        samples[i] += this->m_replay[this->m_replayIndex] * phase;
+        phase *= step;
+      }
+      this->m_replayIndex = (this->m_replayIndex + 1) % this->m_replay.size();
+    }
+  } else {
+    for (const Tone & tone : this->m_tones) {
+      double offset = tone.m_frequency - this->m_frequency;
+      if (fabs(offset) >= this->m_sampleRate / 2.0) {
+        continue;
+      }
+      Sample phase = std::polar(tone.m_amplitude, float(fmod(2 * M_PI * offset * seconds, 2 * M_PI)));
+      Sample step = std::polar(1.0f, float(2 * M_PI * offset / this->m_sampleRate));
+      for (uint32_t i = 0; i < count; i++) {
+        samples[i] += phase;
+        phase *= step;
+      }
+    }
+  }
+  uint64_t settleSamples = uint64_t(this->m_settleTime * this->m_sampleRate);
+  for (uint32_t i = 0; i < count && time + i - this->m_tuneTime < settleSamples; i++) {
+    samples[i] += 0.5f * float(1.0 - double(time + i - this->m_tuneTime) / settleSamples);
+  }
+}
+
+// Split at a pending tune so that each span has one frequency.
+//
+void MockDevice::Generate(Sample * samples, uint64_t time, uint32_t count)
+{
+  uint32_t done = 0;
+  while (done < count) {
+    this->ApplyPendingTune(time + done);
+    uint32_t spanCount = count - done;
+    if (this->m_pendingTime < time + count) {
+      spanCount = uint32_t(this->m_pendingTime - (time + done));
+    }
+    this->GenerateSpan(&samples[done], time + done, spanCount);
+    done += spanCount;
+  }
+}
+
+void MockDevice::Read(Sample * samples, uint32_t count, uint64_t & time)
+{
+  std::unique_lock<std::mutex> lock(this->m_mutex);
+  uint64_t deviceTime = this->GetDeviceTime();
+  if (deviceTime > this->m_streamTime + this->m_bufferSamples) {
+    uint64_t streamTime = deviceTime - this->m_bufferSamples;
+    this->m_droppedSamples += streamTime - this->m_streamTime;
+    this->m_streamTime = streamTime;
+  }
+  time = this->m_streamTime;
+  uint64_t endTime = time + count;
+  if (this->m_paced && endTime > deviceTime) {
+    auto arrival = this->m_startTime
+      + std::chrono::microseconds(uint64_t(1e6 * endTime / this->m_sampleRate));
+    lock.unlock();
+    std::this_thread::sleep_until(arrival);
+    lock.lock();
+  }
+  this->Generate(samples, time, count);
+  this->m_streamTime = endTime;
+}
+
+uint64_t MockDevice::TakeDroppedSamples()
+{
+  std::lock_guard<std::mutex> lock(this->m_mutex);
+  uint64_t droppedSamples = this->m_droppedSamples;
+  this->m_droppedSamples = 0;
+  return droppedSamples;
+}
+
+bool MockDevice::TakeTuneApplied()
+{
+  std::lock_guard<std::mutex> lock(this->m_mutex);
+  bool tuneApplied = this->m_tuneApplied;
+  this->m_tuneApplied = false;
+  return tuneApplied;
+}
+
+int8_t MockToInt8(float value)
+{
+  return int8_t(std::max(-128.0f, std::min(127.0f, roundf(value * 128))));
+}
+
+// The RTL2832 delivers unsigned samples centered on 127.5.
+//
+uint8_t MockToOffsetUInt8(float value)
+{
+  return uint8_t(std::max(0.0f, std::min(255.0f, roundf(value * 128 + 127.5f))));
+}
+
+int16_t MockToInt16(float value, int16_t fullScale)
+{
+  return int16_t(std::max(-float(fullScale), std::min(float(fullScale - 1), roundf(value * fullScale))));
+}
@@ -0,0 +1,97 @@
+#pragma once
+
+#include <cstdint>
+#include <complex>
+#include <chrono>
+#include <mutex>
+#include <random>
+#include <string>
+#include <vector>
+
+// The radio shared by the emulated vendor libraries. It keeps a device
+// clock that advances with wall time at the sample rate, and a stream
+// position that advances as samples are read; a read ahead of the clock
+// waits for it, and a read that falls further behind than the device
+// buffers hold loses the oldest samples, as the hardware does. A tune
+// takes effect a retune latency after it is requested and is followed by
+// a decaying DC offset for the settle time.
+//
+// The received signal is configured from the environment:
+//   SCAN_MOCK_TONES=Hz[:dBFS][,Hz[:dBFS]...]  carriers at absolute frequencies
+//   SCAN_MOCK_NOISE=dBFS                       noise floor, -60 by default
+//   SCAN_MOCK_REPLAY=file                      interleaved float32 IQ played
+//                                              in a loop instead of the tones
+//   SCAN_MOCK_REPLAY_FREQUENCY=Hz              center of the recording; the
+//                                              replay then follows the tuning
+//   SCAN_MOCK_RETUNE=us, SCAN_MOCK_SETTLE=us   override the device defaults
+//   SCAN_MOCK_FAST=1                           do not pace to the device clock
+//
+class MockDevice
+{
+ public:
+  typedef std::complex<float> Sample;
+
+ private:
+  struct Tone
+  {
+    double m_frequency;
+    float m_amplitude;
+  };
+  std::mutex m_mutex;
+  std::string m_name;
+  double m_sampleRate;
+  double m_retuneLatency;
+  double m_settleTime;
+  bool m_paced;
+  uint64_t m_bufferSamples;
+  std::chrono::steady_clock::time_point m_startTime;
+  uint64_t m_streamTime;
+  double m_frequency;
+  double m_pendingFrequency;
+  uint64_t m_pendingTime;
+  uint64_t m_tuneTime;
+  uint64_t m_droppedSamples;
+  bool m_tuneApplied;
+  std::vector<Tone> m_tones;
+  std::vector<Sample> m_noiseTable;
+  std::vector<Sample> m_replay;
+  size_t m_replayIndex;
+  double m_replayFrequency;
+  std::mt19937 m_generator;
+  void Configure();
+  void ApplyPendingTune(uint64_t time);
+  void GenerateSpan(Sample * samples, uint64_t time, uint32_t count);
+  void Generate(Sample * samples, uint64_t time, uint32_t count);
+
+ public:
+  MockDevice(const char * name, double retuneLatency, double settleTime);
+  void SetSampleRate(double sampleRate);
+  double GetSampleRate();
+  // Device buffering, in samples, before a late reader loses samples.
+  void SetBufferSamples(uint64_t bufferSamples);
+  // Restart the device clock and the stream at time 0.
+  void Start();
+  // Samples since Start by the device clock.
+  uint64_t GetDeviceTime();
+  uint64_t GetStreamTime();
+  // Discard buffered samples; the next read starts at the device clock.
+  void Flush();
+  // Request a tune now; it takes effect after the retune latency. With
+  // wait the call returns only then.
+  void Tune(double frequency, bool wait);
+  // Request a tune at a device time, or now if that has passed.
+  void TuneAt(double frequency, uint64_t time);
+  double GetFrequency();
+  // Block until the next count samples have arrived, then return them.
+  // The stream time of the first sample is returned through time.
+  void Read(Sample * samples, uint32_t count, uint64_t & time);
+  // Samples lost by late reads since the last call.
+  uint64_t TakeDroppedSamples();
+  // True once after a requested tune reaches the stream.
+  bool TakeTuneApplied();
+};
+
+// Conversions to the sample formats of the devices, clipped at full scale.
+int8_t MockToInt8(float value);
+uint8_t MockToOffsetUInt8(float value);
+int16_t MockToInt16(float value, int16_t fullScale);
@@ -0,0 +1,183 @@
+#include <stdio.h>
+#include <string.h>
+#include <atomic>
+#include <vector>
+#include <rtl-sdr.h>
+#include "mockDevice.h"
+
+// Emulated librtlsdr. Reads block the calling thread: rtlsdr_read_sync
+// returns once len bytes have arrived, and rtlsdr_read_async loops on the
+// caller's thread calling back with each buffer until cancelled. Samples
+// are unsigned 8 bit, centered on 127.5, and only the dongle's small FIFO
+// holds samples between synchronous reads.
+//
+
+static const uint32_t s_fifoSamples = 16384;
+static const uint32_t s_defaultBufferCount = 15;
+static const uint32_t s_defaultBufferLength = 16 * 32 * 512;
+
+struct rtlsdr_dev
+{
+  MockDevice m_device;
+  std::atomic<bool> m_asyncRunning;
+  std::atomic<bool> m_cancel;
+  bool m_started;
+
+  rtlsdr_dev()
+    : m_device("rtlsdr", 0.002, 0.003),
+      m_asyncRunning(false),
+      m_cancel(false),
+      m_started(false)
+  {
+  }
+};
+
+static void ReadBytes(rtlsdr_dev * dev, uint8_t * buffer, uint32_t len)
+{
+  if (!dev->m_started) {
+    dev->m_device.Start();
+    dev->m_started = true;
+  }
+  uint32_t sampleCount = len / 2;
+  std::vector<MockDevice::Sample> samples(sampleCount);
+  uint64_t time;
+  dev->m_device.Read(samples.data(), sampleCount, time);
+  for (uint32_t i = 0; i < sampleCount; i++) {
+    buffer[2*i] = MockToOffsetUInt8(samples[i].real());
+    buffer[2*i+1] = MockToOffsetUInt8(samples[i].imag());
+  }
+}
+
+extern "C" {
+
+uint32_t rtlsdr_get_device_count(void)
+{
+  return 1;
+}
+
+const char* rtlsdr_get_device_name(uint32_t index)
+{
+  return index == 0 ? "Generic RTL2832U OEM" : "";
+}
+
+int rtlsdr_get_device_usb_strings(uint32_t index, char* manufact, char* product, char* serial)
+{
+  if (index != 0) {
+    return -1;
+  }
+  strcpy(manufact, "Realtek");
+  strcpy(product, "RTL2838UHIDIR");
+  strcpy(serial, "mock");
+  return 0;
+}
+
+int rtlsdr_open(rtlsdr_dev_t** dev, uint32_t index)
+{
+  if (index != 0) {
+    return -1;
+  }
+  *dev = new rtlsdr_dev;
+  return 0;
+}
+
+int rtlsdr_close(rtlsdr_dev_t* dev)
+{
+  if (dev == nullptr) {
+    return -1;
+  }
+  delete dev;
+  return 0;
+}
+
+int rtlsdr_set_sample_rate(rtlsdr_dev_t* dev, uint32_t rate)
+{
+  // The valid ranges of the RTL2832 resampler.
+  if (rate <= 225000 || rate > 3200000 || (rate > 300000 && rate <= 900000)) {
+    return -22;
+  }
+  dev->m_device.SetSampleRate(rate);
+  dev->m_device.SetBufferSamples(s_fifoSamples);
+  return 0;
+}
+
+int rtlsdr_set_tuner_gain_mode(rtlsdr_dev_t* dev, int manual)
+{
+  return 0;
+}
+
+int rtlsdr_set_agc_mode(rtlsdr_dev_t* dev, int on)
+{
+  return 0;
+}
+
+int rtlsdr_set_direct_sampling(rtlsdr_dev_t* dev, int on)
+{
+  return 0;
+}
+
+int rtlsdr_set_tuner_gain(rtlsdr_dev_t* dev, int gain)
+{
+  return 0;
+}
+
+int rtlsdr_set_tuner_if_gain(rtlsdr_dev_t* dev, int stage, int gain)
+{
+  return 0;
+}
+
+int rtlsdr_set_center_freq(rtlsdr_dev_t* dev, uint32_t freq)
+{
+  dev->m_device.Tune(double(freq), true);
+  return 0;
+}
+
+int rtlsdr_reset_buffer(rtlsdr_dev_t* dev)
+{
+  dev->m_device.Flush();
+  return 0;
+}
+
+int rtlsdr_read_sync(rtlsdr_dev_t* dev, void* buf, int len, int* n_read)
+{
+  if (dev->m_asyncRunning) {
+    return -16;
+  }
+  ReadBytes(dev, static_cast<uint8_t *>(buf), uint32_t(len));
+  *n_read = len;
+  return 0;
+}
+
+int rtlsdr_read_async(rtlsdr_dev_t* dev, rtlsdr_read_async_cb_t cb, void* ctx, uint32_t buf_num, uint32_t buf_len)
+{
+  if (dev->m_asyncRunning) {
+    return -16;
+  }
+  if (buf_num == 0) {
+    buf_num = s_defaultBufferCount;
+  }
+  if (buf_len == 0 || buf_len % 512 != 0) {
+    buf_len = s_defaultBufferLength;
+  }
+  dev->m_device.SetBufferSamples(uint64_t(buf_num) * buf_len / 2);
+  dev->m_asyncRunning = true;
+  dev->m_cancel = false;
+  std::vector<uint8_t> buffer(buf_len);
+  while (!dev->m_cancel) {
+    ReadBytes(dev, buffer.data(), buf_len);
+    cb(buffer.data(), buf_len, ctx);
+  }
+  dev->m_device.SetBufferSamples(s_fifoSamples);
+  dev->m_asyncRunning = false;
+  return 0;
+}
+
+int rtlsdr_cancel_async(rtlsdr_dev_t* dev)
+{
+  if (!dev->m_asyncRunning) {
+    return -2;
+  }
+  dev->m_cancel = true;
+  return 0;
+}
+
+}
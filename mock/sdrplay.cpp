@@ -0,0 +1,118 @@
+#include <stdio.h>
+#include <vector>
+#include <mirsdrapi-rsp.h>
+#include "mockDevice.h"
+
+// Emulated SDRplay API. The API drives a single device: mir_sdr_ReadPacket
+// blocks the calling thread for one packet of int16 I and Q samples, and
+// mir_sdr_SetRf returns at once, with rfChanged flagging the first packet
+// after the retune has taken effect.
+//
+
+static const int s_samplesPerPacket = 336;
+static const int16_t s_fullScale = 2048;
+
+static MockDevice * s_device = nullptr;
+static std::vector<MockDevice::Sample> s_samples(s_samplesPerPacket);
+
+extern "C" {
+
+mir_sdr_ErrT mir_sdr_ApiVersion(float* version)
+{
+  *version = MIR_SDR_API_VERSION;
+  return mir_sdr_Success;
+}
+
+mir_sdr_ErrT mir_sdr_Init(int gRdB,
+                          double fsMHz,
+                          double rfMHz,
+                          mir_sdr_Bw_MHzT bwType,
+                          mir_sdr_If_kHzT ifType,
+                          int* samplesPerPacket)
+{
+  if (s_device != nullptr) {
+    return mir_sdr_AlreadyInitialised;
+  }
+  if (fsMHz < 2.0 || fsMHz > 12.0) {
+    return mir_sdr_OutOfRange;
+  }
+  s_device = new MockDevice("sdrplay", 0.001, 0.001);
+  s_device->SetSampleRate(fsMHz * 1e6);
+  s_device->SetBufferSamples(64 * s_samplesPerPacket);
+  s_device->Tune(rfMHz * 1e6, false);
+  s_device->Start();
+  *samplesPerPacket = s_samplesPerPacket;
+  return mir_sdr_Success;
+}
+
+mir_sdr_ErrT mir_sdr_Uninit()
+{
+  if (s_device == nullptr) {
+    return mir_sdr_NotInitialised;
+  }
+  delete s_device;
+  s_device = nullptr;
+  return mir_sdr_Success;
+}
+
+mir_sdr_ErrT mir_sdr_ReadPacket(short* xi,
+                                short* xq,
+                                unsigned int* firstSampleNum,
+                                int* grChanged,
+                                int* rfChanged,
+                                int* fsChanged)
+{
+  if (s_device == nullptr) {
+    return mir_sdr_NotInitialised;
+  }
+  uint64_t time;
+  s_device->Read(s_samples.data(), s_samplesPerPacket, time);
+  for (int i = 0; i < s_samplesPerPacket; i++) {
+    xi[i] = MockToInt16(s_samples[i].real(), s_fullScale);
+    xq[i] = MockToInt16(s_samples[i].imag(), s_fullScale);
+  }
+  *firstSampleNum = uint32_t(time);
+  *grChanged = 0;
+  *rfChanged = s_device->TakeTuneApplied() ? 1 : 0;
+  *fsChanged = 0;
+  return mir_sdr_Success;
+}
+
+mir_sdr_ErrT mir_sdr_ResetUpdateFlags(int resetGainUpdate, int resetRfUpdate, int resetFsUpdate)
+{
+  if (s_device == nullptr) {
+    return mir_sdr_NotInitialised;
+  }
+  if (resetRfUpdate) {
+    s_device->TakeTuneApplied();
+  }
+  return mir_sdr_Success;
+}
+
+// With abs the value is the frequency, otherwise an offset from the
+// current one.
+//
+mir_sdr_ErrT mir_sdr_SetRf(double drfHz, int abs, int syncUpdate)
+{
+  if (s_device == nullptr) {
+    return mir_sdr_NotInitialised;
+  }
+  double frequency = abs ? drfHz : s_device->GetFrequency() + drfHz;
+  if (frequency < 100e3 || frequency > 2000e6) {
+    return mir_sdr_OutOfRange;
+  }
+  s_device->Tune(frequency, false);
+  return mir_sdr_Success;
+}
+
+mir_sdr_ErrT mir_sdr_SetDcMode(int dcCal, int speedUp)
+{
+  return mir_sdr_Success;
+}
+
+mir_sdr_ErrT mir_sdr_SetDcTrackTime(int trackTime)
+{
+  return mir_sdr_Success;
+}
+
+}
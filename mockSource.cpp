@@ -0,0 +1,127 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <math.h>
+#include <algorithm>
+#include <string>
+#include <thread>
+#include "messageQueue.h"
+#include "signalSource.h"
+#include "mockSource.h"
+#include "arguments.h"
+
+MockSource::MockSource(std::string args,
+                       uint32_t sampleRate, 
+                       uint32_t sampleCount, 
+                       double startFrequency, 
+                       double stopFrequency,
+                       double useBandWidth,
+                       double tuneOffset,
+                       std::vector<FrequencyTable::Segment> segments)
+  : SignalSource(sampleRate, sampleCount, startFrequency, stopFrequency, useBandWidth, 0.0, tuneOffset, segments),
+    m_captureBuffer(new fftwf_complex[sampleCount]),
+    m_retuneLatency(0.001),
+    m_settleTime(0.0),
+    m_toneFrequency(0.0),
+    m_toneAmplitude(0.1),
+    m_realTime(false),
+    m_tunedFrequency(0.0),
+    m_samplesSinceRetune(0),
+    m_noise(0.0, 0.01)
+{
+  Arguments arguments(args);
+  if (arguments.HasValue("retune")) {
+    this->m_retuneLatency = arguments.GetIntValue("retune") / 1e6;
+  }
+  if (arguments.HasValue("settle")) {
+    this->m_settleTime = arguments.GetIntValue("settle") / 1e6;
+  }
+  if (arguments.HasValue("tone")) {
+    this->m_toneFrequency = std::stod(arguments.GetStringValue("tone"));
+  }
+  if (arguments.HasValue("level")) {
+    this->m_toneAmplitude = pow(10.0, std::stod(arguments.GetStringValue("level")) / 20);
+  }
+  this->m_realTime = arguments.Has("realtime");
+  this->Retune(this->GetCurrentFrequency());
+}
+
+MockSource::~MockSource()
+{
+  delete [] this->m_captureBuffer;
+}
+
+// Unimplemented.
+bool MockSource::GetNextSamples(SampleQueue * sampleQueue, double & centerFrequency)
+{
+  return false;
+}
+
+bool MockSource::StartStreaming(uint32_t numIterations, SampleQueue & sampleQueue)
+{
+  return this->StartThread(numIterations, sampleQueue);
+}
+
+void MockSource::ThreadWorker()
+{
+  this->RunCaptureLoop();
+}
+
+double MockSource::Retune(double frequency)
+{
+  this->m_tunedFrequency = this->GetTunedFrequency(frequency);
+  this->m_samplesSinceRetune = 0;
+  return frequency;
+}
+
+double MockSource::GetMaxSettleTime()
+{
+  return std::max(0.010, 2 * this->m_settleTime);
+}
+
+bool MockSource::CaptureSamples()
+{
+  auto start = std::chrono::steady_clock::now();
+  double offset = this->m_toneFrequency - this->m_tunedFrequency;
+  bool hasTone = this->m_toneFrequency != 0.0 && fabs(offset) < this->m_sampleRate / 2.0;
+  double phaseIncrement = 2 * M_PI * offset / this->m_sampleRate;
+  uint64_t settleSamples = uint64_t(this->m_settleTime * this->m_sampleRate);
+  for (uint32_t i = 0; i < this->m_sampleCount; i++) {
+    uint64_t n = this->m_samplesSinceRetune + i;
+    float real = this->m_noise(this->m_generator);
+    float imag = this->m_noise(this->m_generator);
+    if (hasTone) {
+      real += this->m_toneAmplitude * cos(phaseIncrement * n);
+      imag += this->m_toneAmplitude * sin(phaseIncrement * n);
+    }
+    if (n < settleSamples) {
+      real += 0.5 * (1.0 - double(n) / settleSamples);
+    }
+    this->m_captureBuffer[i][0] = real;
+    this->m_captureBuffer[i][1] = imag;
+  }
+  this->m_samplesSinceRetune += this->m_sampleCount;
+  if (this->m_realTime) {
+    std::this_thread::sleep_until(start + std::chrono::microseconds(uint64_t(1e6 * this->m_sampleCount / this->m_sampleRate)));
+  }
+  return this->IsSettled(this->m_captureBuffer, this->m_sampleCount);
+}
+
+void MockSource::AppendCapture(double centerFrequency, uint32_t stepIndex, time_t time)
+{
+  this->m_sampleQueue->AppendSamples(this->m_captureBuffer, centerFrequency, stepIndex, time);
+}
+
+void MockSource::BeginRetune(double frequency)
+{
+  this->Retune(frequency);
+  this->m_retuneDeadline = std::chrono::steady_clock::now() 
+    + std::chrono::microseconds(uint64_t(1e6 * this->m_retuneLatency));
+}
+
+// The simulated latency is only waited for where it was not hidden by the
+// work done since the retune was issued.
+//
+void MockSource::FinishRetune()
+{
+  std::this_thread::sleep_until(this->m_retuneDeadline);
+}
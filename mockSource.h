@@ -0,0 +1,47 @@
+#pragma once
+
+#include <chrono>
+#include <random>
+
+// Simulated device for testing without hardware. It produces complex
+// gaussian noise, optionally a tone at a fixed frequency, and after each
+// retune a decaying DC offset for the settle time, with a simulated retune
+// latency. Device args, times in microseconds:
+//   mock[,retune=N][,settle=N][,tone=Hz][,level=dBFS][,realtime]
+// With realtime each capture takes as long as the samples would take to
+// arrive.
+//
+class MockSource : public SignalSource
+{
+  fftwf_complex * m_captureBuffer;
+  double m_retuneLatency;
+  double m_settleTime;
+  double m_toneFrequency;
+  double m_toneAmplitude;
+  bool m_realTime;
+  double m_tunedFrequency;
+  uint64_t m_samplesSinceRetune;
+  std::chrono::steady_clock::time_point m_retuneDeadline;
+  std::mt19937 m_generator;
+  std::normal_distribution<float> m_noise;
+  virtual double GetMaxSettleTime();
+  virtual bool CaptureSamples();
+  virtual void AppendCapture(double centerFrequency, uint32_t stepIndex, time_t time);
+  virtual void BeginRetune(double frequency);
+  virtual void FinishRetune();
+
+ public:
+  MockSource(std::string args,
+             uint32_t sampleRate, 
+             uint32_t sampleCount, 
+             double startFrequency, 
+             double stopFrequency,
+             double useBandWidth = 0.75,
+             double tuneOffset = 0.0,
+             std::vector<FrequencyTable::Segment> segments = std::vector<FrequencyTable::Segment>());
+  virtual ~MockSource();
+  virtual bool GetNextSamples(SampleQueue * sampleQueue, double_t & centerFrequency);
+  virtual bool StartStreaming(uint32_t numIterations, SampleQueue & sampleQueue);
+  virtual void ThreadWorker();
+  virtual double Retune(double frequency);
+};
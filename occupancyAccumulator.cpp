@@ -0,0 +1,96 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <math.h>
+#include <cassert>
+#include "occupancyAccumulator.h"
+
+OccupancyAccumulator::OccupancyAccumulator(FrequencyTable * frequencyTable,
+                                           const std::vector<StepSpectrum> & stepSpectra,
+                                           std::string fileName,
+                                           float powerThreshold,
+                                           double channelWidth,
+                                           uint32_t interval)
+  : SpectrumAccumulator(frequencyTable, stepSpectra, fileName),
+    m_powerThreshold(powerThreshold),
+    m_interval(interval),
+    m_lastSnapshot(time(NULL))
+{
+  this->m_occupancy.resize(this->m_stepCount);
+  for (uint32_t step = 0; step < this->m_stepCount; step++) {
+    Occupancy & occupancy = this->m_occupancy[step];
+    uint32_t binCount = stepSpectra[step].m_binCount;
+    uint32_t channelBins = 
+      std::max<uint32_t>(1, lround(channelWidth / stepSpectra[step].m_binWidth));
+    occupancy.m_binCounts.assign(binCount, 0);
+    occupancy.m_channelCounts.assign((binCount + channelBins - 1) / channelBins, 0);
+    occupancy.m_channelBins = channelBins;
+    occupancy.m_count = 0;
+  }
+  this->m_mask.resize((this->m_binCount + 63) / 64);
+  this->m_frame.resize(2 * this->m_binCount);
+}
+
+void OccupancyAccumulator::Finish()
+{
+  std::unique_lock<std::mutex> locker(this->m_mutex);
+  this->WriteSnapshot(0);
+}
+
+// Build the mask of bins above the threshold, then visit only the set bits.
+//
+void OccupancyAccumulator::DoUpdate(uint32_t step, uint64_t sequenceId, const float * powers)
+{
+  Occupancy & occupancy = this->m_occupancy[step];
+  uint32_t binCount = this->m_stepSpectra[step].m_binCount;
+  uint32_t wordCount = (binCount + 63) / 64;
+  for (uint32_t w = 0; w < wordCount; w++) {
+    uint32_t first = w * 64;
+    uint32_t count = std::min(binCount - first, 64u);
+    uint64_t word = 0;
+    for (uint32_t i = 0; i < count; i++) {
+      word |= uint64_t(powers[first + i] > this->m_powerThreshold) << i;
+    }
+    this->m_mask[w] = word;
+  }
+  int64_t lastChannel = -1;
+  for (uint32_t w = 0; w < wordCount; w++) {
+    uint64_t word = this->m_mask[w];
+    while (word != 0) {
+      uint32_t bin = w * 64 + __builtin_ctzll(word);
+      word &= word - 1;
+      occupancy.m_binCounts[bin]++;
+      // Bits are visited in order, so a channel is counted once.
+      int64_t channel = bin / occupancy.m_channelBins;
+      if (channel != lastChannel) {
+        occupancy.m_channelCounts[channel]++;
+        lastChannel = channel;
+      }
+    }
+  }
+  occupancy.m_count++;
+  time_t now = time(NULL);
+  if (now - this->m_lastSnapshot >= this->m_interval) {
+    this->WriteSnapshot(sequenceId);
+    this->m_lastSnapshot = now;
+  }
+}
+
+void OccupancyAccumulator::WriteSnapshot(uint64_t sequenceId)
+{
+  for (uint32_t step = 0; step < this->m_stepCount; step++) {
+    Occupancy & occupancy = this->m_occupancy[step];
+    uint32_t binCount = occupancy.m_binCounts.size();
+    uint32_t channelCount = occupancy.m_channelCounts.size();
+    memcpy(&this->m_frame[0], &occupancy.m_binCounts[0], sizeof(uint32_t) * binCount);
+    memcpy(&this->m_frame[binCount], 
+           &occupancy.m_channelCounts[0], 
+           sizeof(uint32_t) * channelCount);
+    this->WriteFrame(step, 
+                     sequenceId, 
+                     occupancy.m_count, 
+                     &this->m_frame[0], 
+                     sizeof(uint32_t) * (binCount + channelCount));
+  }
+}
@@ -0,0 +1,39 @@
+#pragma once
+
+#include "accumulator.h"
+
+// Spectrum occupancy per step: how many spectra had each bin, and each
+// channel of the bins within channelWidth Hz, above the power threshold. The counters are
+// cumulative, and a snapshot of all steps, a frame per step with the bin
+// counts followed by the channel counts, is written every interval seconds.
+// The frame count is the number of spectra of the step. Finish writes the
+// snapshot of the last, partial, interval.
+//
+class OccupancyAccumulator : public SpectrumAccumulator
+{
+  struct Occupancy
+  {
+    std::vector<uint32_t> m_binCounts;
+    std::vector<uint32_t> m_channelCounts;
+    uint32_t m_channelBins;
+    uint32_t m_count;
+  };
+  std::vector<Occupancy> m_occupancy;
+  std::vector<uint64_t> m_mask;
+  std::vector<uint32_t> m_frame;
+  float m_powerThreshold;
+  uint32_t m_interval;
+  time_t m_lastSnapshot;
+
+  void DoUpdate(uint32_t step, uint64_t sequenceId, const float * powers);
+  void WriteSnapshot(uint64_t sequenceId);
+
+ public:
+  OccupancyAccumulator(FrequencyTable * frequencyTable,
+                       const std::vector<StepSpectrum> & stepSpectra,
+                       std::string fileName,
+                       float powerThreshold,
+                       double channelWidth,
+                       uint32_t interval);
+  void Finish();
+};
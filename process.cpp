@@ -10,14 +10,34 @@
 #include "messageQueue.h"
 #include "signalSource.h"
 #include "process.h"
+#include "correlator.h"
+#include "channelizer.h"
+#include "downconverter.h"
+#include "accumulator.h"
+#include "spurTable.h"
 
-FFTWindow::FFTWindow(gr::fft::window::win_type type, uint32_t numSamples)
+// The polyphase window is the window stretched over taps blocks times a
+// sinc with a main lobe of one block, so each bin's response is about one
+// bin wide with far less leakage than a single block window.
+//
+FFTWindow::FFTWindow(gr::fft::window::win_type type, uint32_t numSamples, uint32_t taps)
   : m_type(type),
-    m_numSamples(numSamples)
+    m_numSamples(numSamples),
+    m_taps(taps)
 {
-  this->m_windowVector = gr::fft::window::build(type, numSamples, 0.0);
-  this->m_window = reinterpret_cast<float *>(fftwf_malloc(sizeof(float) * numSamples));
-  memcpy(this->m_window, &this->m_windowVector[0], sizeof(float) * numSamples);
+  uint32_t length = taps * numSamples;
+  this->m_windowVector = gr::fft::window::build(type, length, 0.0);
+  if (taps > 1) {
+    double center = (length - 1) / 2.0;
+    for (uint32_t i = 0; i < length; i++) {
+      double x = M_PI * (i - center) / numSamples;
+      if (x != 0.0) {
+        this->m_windowVector[i] *= sin(x) / x;
+      }
+    }
+  }
+  this->m_window = reinterpret_cast<float *>(fftwf_malloc(sizeof(float) * length));
+  memcpy(this->m_window, &this->m_windowVector[0], sizeof(float) * length);
 }
 
 FFTWindow::~FFTWindow()
@@ -30,37 +50,155 @@ void FFTWindow::apply(fftwf_complex * samples)
   volk_32fc_32f_multiply_32fc_a(reinterpret_cast<lv_32fc_t *>(samples), 
                                 reinterpret_cast<lv_32fc_t *>(samples), 
                                 this->m_window, 
-                                this->m_numSamples);
+                                this->m_taps * this->m_numSamples);
+  for (uint32_t k = 1; k < this->m_taps; k++) {
+    volk_32f_x2_add_32f(reinterpret_cast<float *>(samples),
+                        reinterpret_cast<float *>(samples),
+                        reinterpret_cast<float *>(samples + k * this->m_numSamples),
+                        2 * this->m_numSamples);
+  }
+}
+
+double FFTWindow::GetCoherentGain()
+{
+  double gain = 0.0;
+  for (auto value : this->m_windowVector) {
+    gain += value;
+  }
+  return gain;
+}
+
+double FFTWindow::GetEnergy()
+{
+  double energy = 0.0;
+  for (auto value : this->m_windowVector) {
+    energy += value * value;
+  }
+  return energy;
 }
 
-bool ProcessSamples::process_fft(fftwf_complex * fft_data, SampleQueue::MessageHeader * header)
+// The used band is -m_useWindow..m_useWindow bins around DC, less the DC
+// window, kept as spans of bins with their power thresholds in
+// m_usedSpans, or in the descriptor of the step when a frequency table is
+// set. fft_data is the full FFT output, or the used band alone when the
+// FFT is pruned. When ranges is given only the bins within them are
+// checked.
+//
+bool ProcessSamples::process_fft(fftwf_complex * fft_data, 
+                                 SampleQueue::MessageHeader * header,
+                                 Detection & detection,
+                                 const std::vector<BinRange> * ranges)
 {
   double start_frequency = header->m_frequency - this->m_sampleRate/2;
-  uint32_t bin_step = this->m_sampleRate/this->m_sampleCount;
-  float magnitudes[this->m_sampleCount];
+  double bin_step = double(this->m_sampleRate)/this->m_fftSize;
+  uint32_t fftSize = this->m_fftSize;
+  const std::vector<BinSpan> * spans = &this->m_usedSpans;
+  const float * passband = this->m_passband.empty() ? nullptr : &this->m_passband[0];
+  if (!this->m_stepDescriptors.empty()) {
+    const StepDescriptor * descriptor = static_cast<const StepDescriptor *>(
+      this->m_frequencyTable->GetProcessInfoForIndex(header->m_stepIndex));
+    start_frequency = descriptor->m_startFrequency;
+    bin_step = descriptor->m_binWidth;
+    fftSize = descriptor->m_fftSize;
+    spans = &descriptor->m_spans;
+    passband = descriptor->m_passband;
+  }
+  int32_t halfSampleCount = fftSize/2;
+  int32_t useWindow = std::min(int32_t(this->m_useWindow), halfSampleCount);
+  bool pruned = this->m_prunedFFT != nullptr && fftSize == this->m_fftSize;
 
-  Utility::complex_to_magnitude(fft_data, magnitudes, this->m_sampleCount);
-  bool trigger = false;
+  float powers[fftSize];
   uint32_t triggerCount = 0;
-  uint32_t halfSampleCount = this->m_sampleCount/2;
-  for (uint32_t i = 0; i < this->m_sampleCount; i++) {
-    uint32_t j = (i + halfSampleCount) % this->m_sampleCount;
-    if (j < this->m_dcIgnoreWindow || (this->m_sampleCount - j) < this->m_dcIgnoreWindow) {
-      continue;
+  double lowFrequency = 0.0;
+  double highFrequency = 0.0;
+  auto scan = [&](int32_t firstBin, int32_t lastBin, float powerThreshold) {
+    // Spans do not cross DC, so they are contiguous in either layout.
+    fftwf_complex * data = fft_data + firstBin + useWindow;
+    if (!pruned) {
+      data = fft_data + (firstBin < 0 ? fftSize + firstBin : firstBin);
     }
-    if (i < (halfSampleCount - this->m_useWindow) || i > (halfSampleCount + this->m_useWindow)) {
-      continue;
+    int32_t count = lastBin - firstBin + 1;
+    volk_32fc_magnitude_squared_32f(powers, reinterpret_cast<lv_32fc_t *>(data), count);
+    if (passband != nullptr) {
+      volk_32f_x2_multiply_32f(powers, powers, &passband[firstBin + halfSampleCount], count);
     }
-    if (magnitudes[j] > this->m_threshold) {
-      double frequency = start_frequency + i*bin_step;
+    for (int32_t i = 0; i < count; i++) {
+      if (powers[i] <= powerThreshold) {
+        continue;
+      }
+      float magnitude = 5 * log10(powers[i]);
+      double frequency = start_frequency + (firstBin + i + halfSampleCount)*bin_step;
       // printf("Sequence[%llu] ", header->m_sequenceId);
-      printf("freq %lu power_db %f\n", uint64_t(frequency), magnitudes[j]);
-      trigger = true;
+      printf("freq %lu power_db %f\n", uint64_t(frequency), magnitude);
+      if (triggerCount == 0) {
+        lowFrequency = frequency;
+      }
+      highFrequency = frequency;
+      if (triggerCount == 0 || magnitude > detection.m_peakPower) {
+        detection.m_peakPower = magnitude;
+        detection.m_peakFrequency = frequency;
+      }
       triggerCount++;
     }
+  };
+  for (auto & span : *spans) {
+    if (ranges == nullptr) {
+      scan(span.m_firstBin, span.m_lastBin, span.m_powerThreshold);
+      continue;
+    }
+    for (auto & range : *ranges) {
+      int32_t first = std::max(span.m_firstBin, range.first);
+      int32_t last = std::min(span.m_lastBin, range.second);
+      if (first <= last) {
+        scan(first, last, span.m_powerThreshold);
+      }
+    }
+  }
+  if (triggerCount > 0) {
+    detection.m_frequency = (lowFrequency + highFrequency) / 2;
+    detection.m_bandWidth = highFrequency - lowFrequency + bin_step;
+    detection.m_binCount = triggerCount;
   }
   return triggerCount > 1047;
-  //return trigger;
+}
+
+// Split the used band of an FFT of fftSize into the spans below and above
+// the DC window. With a tune offset the DC spike and the edges of the
+// sampled band sit offset Hz below where they would, and the used band is
+// clipped on each side to what is left.
+//
+std::vector<ProcessSamples::BinSpan> ProcessSamples::GetUsedSpans(uint32_t fftSize)
+{
+  int32_t halfSampleCount = fftSize/2;
+  int32_t useWindow = std::min(int32_t(uint64_t(this->m_useWindow) * fftSize / this->m_fftSize), 
+                               halfSampleCount);
+  // The DC window covers the same width in Hz, rounded up to whole bins.
+  int32_t dcIgnoreWindow = 
+    int32_t((uint64_t(this->m_dcIgnoreWindow) * fftSize + this->m_fftSize - 1) / this->m_fftSize);
+  int32_t offsetBins = int32_t(round(this->m_tuneOffset * fftSize / this->m_sampleRate));
+  int32_t dcBin = -offsetBins;
+  int32_t first = std::max(-useWindow, -halfSampleCount - std::min(offsetBins, 0));
+  int32_t last = std::min(std::min(useWindow, halfSampleCount - 1), 
+                          halfSampleCount - 1 - std::max(offsetBins, 0));
+  std::vector<BinSpan> spans;
+  auto addSpan = [&](int32_t firstBin, int32_t lastBin) {
+    // Spans must not cross bin 0, where the unshifted FFT output wraps.
+    if (firstBin < 0 && lastBin >= 0) {
+      spans.push_back(BinSpan{firstBin, -1, this->m_powerThreshold});
+      firstBin = 0;
+    }
+    if (firstBin <= lastBin) {
+      spans.push_back(BinSpan{firstBin, lastBin, this->m_powerThreshold});
+    }
+  };
+  addSpan(first, std::min(last, dcBin - std::max(dcIgnoreWindow, 1)));
+  addSpan(std::max(first, dcBin + dcIgnoreWindow), last);
+  return spans;
+}
+
+void ProcessSamples::UpdateUsedSpans()
+{
+  this->m_usedSpans = this->GetUsedSpans(this->m_fftSize);
 }
 
 ProcessSamples::ProcessSamples(uint32_t numSamples, 
@@ -74,19 +212,31 @@ ProcessSamples::ProcessSamples(uint32_t numSamples,
                                double useBandWidth,
                                double dcIgnoreWidth,
                                uint32_t preTrigger,
-                               uint32_t postTrigger)
+                               uint32_t postTrigger,
+                               uint32_t windowTaps)
   : m_sampleCount(numSamples),
+    m_fftSize(numSamples / windowTaps),
     m_sampleRate(sampleRate),
     m_enob(enob),
     m_fileCounter(0),
     m_threshold(threshold),
-    m_fftWindow(windowType, numSamples),
+    m_powerThreshold(pow(10.0, threshold / 5)),
+    m_processedBlocks(0),
+    m_skippedBlocks(0),
+    m_coarseSkippedBlocks(0),
+    m_fftWindow(windowType, numSamples / windowTaps, windowTaps),
     m_correctDCOffset(false),
-    m_useWindow(uint32_t(useBandWidth * numSamples / 2.0)),
+    m_useBandWidth(useBandWidth),
+    m_useWindow(uint32_t(useBandWidth * numSamples / windowTaps / 2.0)),
     // This is only for hackRF.
     m_dcIgnoreWindow(4), 
     // m_dcIgnoreWindow(uint32_t(dcIgnoreWidth * numSamples / 2.0)),
-    m_fft(numSamples),
+    m_fft(numSamples / windowTaps),
+    m_prunedFFT(nullptr),
+    m_finished(false),
+    m_coarseFFT(nullptr),
+    m_coarseWindow(nullptr),
+    m_coarsePowerThreshold(0.0),
     m_mode(mode),
     m_sampleQueue(nullptr),
     m_fileNameBase(fileNameBase),
@@ -94,17 +244,62 @@ ProcessSamples::ProcessSamples(uint32_t numSamples,
     m_postTrigger(postTrigger),
     m_writing(false),
     m_endSequenceId(0),
+    m_dwellSource(nullptr),
+    m_dwellCaptures(0),
+    m_writeStepIndex(0),
+    m_writeTriggerSequenceId(0),
+    m_postRemaining(0),
+    m_correlator(nullptr),
+    m_channelizer(nullptr),
+    m_channelThreshold(0.0),
+    m_channelFile(nullptr),
+    m_writeNarrowband(false),
+    m_zoomDecimation(0),
+    m_zoomBlockCount(0),
+    m_zoomFFT(nullptr),
+    m_zoomWindow(nullptr),
+    m_tuneOffset(0.0),
+    m_passbandMaximum(1.0),
+    m_frequencyTable(nullptr),
+    m_spurMargin(0.0),
+    m_calibrationCount(0),
+    m_tunePhaseIncrement(1.0, 0.0),
+    m_timeDomainWindow(1),
     m_threadCount(threadCount)
 {
-  assert(mode > Illegal && mode <= FrequencyDomain);
+  assert(mode > Illegal && mode <= Correlation);
   assert(threadCount <= MAX_THREADS);
+  assert(windowTaps == 1 || (mode == FrequencyDomain && numSamples % windowTaps == 0));
   for (uint32_t threadId = 0; threadId < threadCount; threadId++) {
     this->m_inputSamples[threadId] = 
       reinterpret_cast<fftwf_complex *>(fftwf_alloc_complex(numSamples));
     this->m_fftOutputBuffer[threadId] = 
       reinterpret_cast<fftwf_complex *>(fftwf_alloc_complex(numSamples));
+    this->m_correlationBuffer[threadId] = nullptr;
+    this->m_channelizerBuffer[threadId] = nullptr;
+    this->m_prunedBuffer[threadId] = nullptr;
+    this->m_coarseBuffer[threadId] = nullptr;
+    this->m_zoomDownconverters[threadId] = nullptr;
+    this->m_zoomSamples[threadId] = nullptr;
+    this->m_zoomBuffer[threadId] = nullptr;
     this->m_threads[threadId] = nullptr;
   }
+  this->UpdateUsedSpans();
+  // By Cauchy-Schwarz no bin of the windowed FFT exceeds the window energy
+  // times the block energy.
+  this->m_energyThreshold = this->m_powerThreshold / this->m_fftWindow.GetEnergy();
+  // Narrow use band widths leave most of the FFT output unused.
+  uint32_t fftSize = this->m_fftSize;
+  uint32_t usedBins = std::min(this->m_useWindow, fftSize / 2);
+  int radix = PrunedFFT::chooseRadix(fftSize, 2 * usedBins + 1);
+  if (mode == FrequencyDomain && radix > 1) {
+    this->m_prunedFFT = new PrunedFFT(fftSize, fftSize - usedBins, 2 * usedBins + 1, radix);
+    for (uint32_t threadId = 0; threadId < threadCount; threadId++) {
+      this->m_prunedBuffer[threadId] = 
+        reinterpret_cast<fftwf_complex *>(fftwf_alloc_complex(fftSize));
+    }
+    printf("Pruned FFT: radix %d, %u of %u bins\n", radix, 2 * usedBins + 1, fftSize);
+  }
 }
 
 ProcessSamples::~ProcessSamples()
@@ -112,7 +307,525 @@ ProcessSamples::~ProcessSamples()
   for (uint32_t threadId = 0; threadId < this->m_threadCount; threadId++) {
     fftwf_free(this->m_inputSamples[threadId]);
     fftwf_free(this->m_fftOutputBuffer[threadId]);
+    if (this->m_correlationBuffer[threadId] != nullptr) {
+      fftwf_free(this->m_correlationBuffer[threadId]);
+    }
+    if (this->m_channelizerBuffer[threadId] != nullptr) {
+      fftwf_free(this->m_channelizerBuffer[threadId]);
+    }
+    if (this->m_prunedBuffer[threadId] != nullptr) {
+      fftwf_free(this->m_prunedBuffer[threadId]);
+    }
+    if (this->m_coarseBuffer[threadId] != nullptr) {
+      fftwf_free(this->m_coarseBuffer[threadId]);
+    }
+    delete this->m_zoomDownconverters[threadId];
+    if (this->m_zoomSamples[threadId] != nullptr) {
+      fftwf_free(this->m_zoomSamples[threadId]);
+      fftwf_free(this->m_zoomBuffer[threadId]);
+    }
+  }
+  for (auto accumulator : this->m_accumulators) {
+    delete accumulator;
+  }
+  delete this->m_prunedFFT;
+  delete this->m_coarseFFT;
+  delete this->m_coarseWindow;
+  if (this->m_channelFile != nullptr) {
+    fclose(this->m_channelFile);
+  }
+  delete this->m_zoomFFT;
+  delete this->m_zoomWindow;
+  for (auto & entry : this->m_transformPlans) {
+    delete entry.second.m_fft;
+    delete entry.second.m_window;
+  }
+}
+
+void ProcessSamples::SetCorrelator(Correlator * correlator)
+{
+  this->m_correlator = correlator;
+  for (uint32_t threadId = 0; threadId < this->m_threadCount; threadId++) {
+    if (this->m_correlationBuffer[threadId] == nullptr) {
+      this->m_correlationBuffer[threadId] = fftwf_alloc_complex(2 * this->m_sampleCount);
+    }
+  }
+}
+
+void ProcessSamples::SetChannelizer(Channelizer * channelizer, float threshold)
+{
+  this->m_channelizer = channelizer;
+  this->m_channelThreshold = threshold;
+  for (uint32_t threadId = 0; threadId < this->m_threadCount; threadId++) {
+    if (this->m_channelizerBuffer[threadId] == nullptr) {
+      this->m_channelizerBuffer[threadId] = 
+        fftwf_alloc_complex(2 * channelizer->GetChannelCount());
+    }
+  }
+  // Channels above the threshold are recorded into a single file, one
+  // chunk per block and channel, each preceded by a RecordHeader.
+  if (this->m_fileNameBase != "") {
+    std::string fileName = this->m_fileNameBase + "channels";
+    this->m_channelFile = fopen(fileName.c_str(), "w");
+    if (this->m_channelFile == nullptr) {
+      fprintf(stderr, "Failed to open file '%s'\n", fileName.c_str());
+      exit(1);
+    }
+  }
+}
+
+void ProcessSamples::SetWriteNarrowband(bool writeNarrowband)
+{
+  this->m_writeNarrowband = writeNarrowband;
+}
+
+void ProcessSamples::SetTriggerDwell(SignalSource * signalSource, uint32_t captureCount)
+{
+  this->m_dwellSource = signalSource;
+  this->m_dwellCaptures = captureCount;
+}
+
+// The source tunes offset Hz below each step frequency. The offset must be
+// a whole number of cycles per block, including the blocks of segments with
+// their own FFT size, so each block can start the shift at phase 0 and
+// consecutive blocks stay continuous. The DC spike then lands offset Hz
+// below the step frequency, where the DC window follows it.
+//
+void ProcessSamples::SetTuneOffset(double offset)
+{
+  double cycles = offset * this->m_sampleCount / this->m_sampleRate;
+  assert(fabs(cycles - round(cycles)) < 1e-6);
+  this->m_tuneOffset = offset;
+  double phaseIncrement = -2 * M_PI * offset / this->m_sampleRate;
+  this->m_tunePhaseIncrement = lv_32fc_t(cos(phaseIncrement), sin(phaseIncrement));
+  this->UpdateUsedSpans();
+}
+
+// Calibration averages the full power spectrum of every block, which
+// should see a flat input such as a terminated antenna port or wideband
+// noise, and writes the correction for each bin to fileName when done.
+//
+void ProcessSamples::SetCalibration(std::string fileName)
+{
+  assert(this->m_mode == FrequencyDomain);
+  this->m_calibrationFileName = fileName;
+  this->m_calibrationSums.assign(this->m_fftSize, 0.0);
+}
+
+// Load a passband correction written by a calibration run with the same
+// sample rate, FFT size, tune offset and use band width. The bounds used to
+// skip blocks have to allow for the largest correction.
+//
+void ProcessSamples::SetPassband(std::string fileName)
+{
+  FILE * inFile = fopen(fileName.c_str(), "r");
+  if (inFile == nullptr) {
+    fprintf(stderr, "Failed to open file '%s'\n", fileName.c_str());
+    exit(1);
+  }
+  PassbandHeader header;
+  if (fread(&header, sizeof(header), 1, inFile) != 1 
+      || header.m_sampleRate != this->m_sampleRate
+      || header.m_fftSize != this->m_fftSize
+      || header.m_tuneOffset != this->m_tuneOffset
+      || header.m_useBandWidth != this->m_useBandWidth) {
+    fprintf(stderr, 
+            "Passband file '%s' does not match sample rate %u, FFT size %u, "
+            "tune offset %.0f and use band width %f\n", 
+            fileName.c_str(),
+            this->m_sampleRate,
+            this->m_fftSize,
+            this->m_tuneOffset,
+            this->m_useBandWidth);
+    exit(1);
+  }
+  this->m_passband.resize(this->m_fftSize);
+  if (fread(&this->m_passband[0], sizeof(float), this->m_fftSize, inFile) != this->m_fftSize) {
+    fprintf(stderr, "Passband file '%s' is truncated\n", fileName.c_str());
+    exit(1);
+  }
+  fclose(inFile);
+  this->m_passbandMaximum = 
+    std::max(1.0f, *std::max_element(this->m_passband.begin(), this->m_passband.end()));
+  this->m_energyThreshold = 
+    this->m_powerThreshold / (this->m_fftWindow.GetEnergy() * this->m_passbandMaximum);
+}
+
+void ProcessSamples::Calibrate(uint32_t threadId)
+{
+  uint32_t fftSize = this->m_fftSize;
+  this->m_fftWindow.apply(this->m_inputSamples[threadId]);
+  this->m_fft.execute(this->m_fftOutputBuffer[threadId], this->m_inputSamples[threadId]);
+  float powers[fftSize];
+  volk_32fc_magnitude_squared_32f(powers, 
+                                  reinterpret_cast<lv_32fc_t *>(this->m_fftOutputBuffer[threadId]), 
+                                  fftSize);
+  std::unique_lock<std::mutex> locker(this->m_calibrationMutex);
+  for (uint32_t k = 0; k < fftSize; k++) {
+    // Store the lowest frequency first.
+    this->m_calibrationSums[(k + fftSize / 2) % fftSize] += powers[k];
+  }
+  this->m_calibrationCount++;
+}
+
+// The correction brings each bin to the mean level near the center, leaving
+// out the DC bins, and is limited to 20 dB. When the scan is interrupted the
+// workers may still be adding blocks.
+//
+void ProcessSamples::WriteCalibration()
+{
+  std::unique_lock<std::mutex> locker(this->m_calibrationMutex);
+  int32_t fftSize = this->m_fftSize;
+  int32_t half = fftSize / 2;
+  double reference = 0.0;
+  uint32_t referenceCount = 0;
+  for (int32_t k = -fftSize / 8; k <= fftSize / 8; k++) {
+    if (abs(k) >= 4) {
+      reference += this->m_calibrationSums[k + half];
+      referenceCount++;
+    }
+  }
+  reference /= referenceCount;
+  std::vector<float> correction(fftSize);
+  for (int32_t k = -half; k < half; k++) {
+    double sum = this->m_calibrationSums[k + half];
+    if (abs(k) < 4 || sum <= 0.0) {
+      correction[k + half] = 1.0;
+    } else {
+      correction[k + half] = std::min(reference / sum, 100.0);
+    }
+  }
+  FILE * outFile = fopen(this->m_calibrationFileName.c_str(), "w");
+  if (outFile == nullptr) {
+    fprintf(stderr, "Failed to open file '%s'\n", this->m_calibrationFileName.c_str());
+    return;
+  }
+  PassbandHeader header{this->m_sampleRate, 
+                        this->m_fftSize, 
+                        this->m_tuneOffset, 
+                        this->m_useBandWidth};
+  fwrite(&header, sizeof(header), 1, outFile);
+  fwrite(&correction[0], sizeof(float), fftSize, outFile);
+  fclose(outFile);
+  printf("Wrote passband calibration of %lu blocks to '%s'\n", 
+         this->m_calibrationCount,
+         this->m_calibrationFileName.c_str());
+}
+
+void ProcessSamples::SetFrequencyTable(FrequencyTable * frequencyTable)
+{
+  this->m_frequencyTable = frequencyTable;
+}
+
+// Mask the spurs learned for each step, applied when the step descriptors
+// are built.
+//
+void ProcessSamples::SetSpurs(std::string fileName, float margin)
+{
+  assert(this->m_mode == FrequencyDomain);
+  this->m_spurFileName = fileName;
+  this->m_spurMargin = margin;
+}
+
+// Bands added later override the earlier ones where they overlap.
+//
+void ProcessSamples::AddBandThreshold(double startFrequency, 
+                                      double stopFrequency, 
+                                      float threshold)
+{
+  this->m_bandThresholds.push_back(BandThreshold{startFrequency, 
+                                                 stopFrequency, 
+                                                 float(pow(10.0, threshold / 5))});
+}
+
+void ProcessSamples::AddExclusion(double startFrequency, double stopFrequency)
+{
+  this->m_bandThresholds.push_back(BandThreshold{startFrequency, stopFrequency, INFINITY});
+}
+
+// Build the descriptor of each step and hang it off the frequency table
+// entry. The threshold of each used bin is resolved once here, from the
+// use band width, threshold and exclusions of the step's frequency plan
+// segment, the band thresholds, exclusions and learned spurs, and the bins
+// are then run length encoded into spans, so the detection loop only pays
+// per threshold change. A spur bin's threshold is raised to margin dB above
+// the spur, so a signal well above the spur is still caught. The energy and
+// coarse gates of the step follow from the lowest of its bin thresholds.
+// Steps with their own FFT size get the passband averaged down to it.
+//
+void ProcessSamples::BuildStepDescriptors()
+{
+  FrequencyTable * frequencyTable = this->m_frequencyTable;
+  uint32_t stepCount = frequencyTable->GetFrequencyCount();
+  std::vector<std::vector<Spur>> stepSpurs(stepCount);
+  if (this->m_spurFileName != "") {
+    std::vector<Spur> spurs = SpurLearner::Read(this->m_spurFileName, 
+                                                this->m_sampleRate, 
+                                                this->m_fftSize);
+    for (auto & spur : spurs) {
+      if (spur.m_step < stepCount) {
+        stepSpurs[spur.m_step].push_back(spur);
+      }
+    }
+    printf("Masked %lu spurs\n", spurs.size());
   }
+  std::vector<float> thresholds;
+  this->m_stepDescriptors.assign(stepCount, StepDescriptor());
+  for (uint32_t step = 0; step < stepCount; step++) {
+    StepDescriptor & descriptor = this->m_stepDescriptors[step];
+    const FrequencyTable::Segment & segment = frequencyTable->GetSegmentFromIndex(step);
+    uint32_t fftSize = this->GetStepFFTSize(step);
+    FFTWindow * window = &this->m_fftWindow;
+    std::vector<BinSpan> usedSpans = this->m_usedSpans;
+    descriptor.m_passband = this->m_passband.empty() ? nullptr : &this->m_passband[0];
+    if (fftSize != this->m_fftSize) {
+      TransformPlan & plan = this->m_transformPlans[fftSize];
+      if (plan.m_fft == nullptr) {
+        plan.m_fft = new FFT(fftSize);
+        plan.m_window = new FFTWindow(this->m_fftWindow.m_type, fftSize);
+      }
+      if (!this->m_passband.empty() && plan.m_passband.empty()) {
+        // A bin of the smaller FFT spans ratio bins of the calibrated one.
+        int32_t ratio = this->m_fftSize / fftSize;
+        plan.m_passband.resize(fftSize);
+        for (int32_t k = 0; k < int32_t(fftSize); k++) {
+          double sum = 0.0;
+          for (int32_t j = k * ratio - ratio / 2; j < k * ratio + ratio - ratio / 2; j++) {
+            sum += this->m_passband[std::min(std::max(j, 0), int32_t(this->m_fftSize) - 1)];
+          }
+          plan.m_passband[k] = sum / ratio;
+        }
+      }
+      window = plan.m_window;
+      usedSpans = this->GetUsedSpans(fftSize);
+      if (!plan.m_passband.empty()) {
+        descriptor.m_passband = &plan.m_passband[0];
+      }
+      double cycles = this->m_tuneOffset * fftSize / this->m_sampleRate;
+      assert(fabs(cycles - round(cycles)) < 1e-6);
+    }
+    int32_t halfSampleCount = fftSize/2;
+    double binWidth = double(this->m_sampleRate)/fftSize;
+    descriptor.m_startFrequency = 
+      frequencyTable->GetFrequencyFromIndex(step) - this->m_sampleRate/2;
+    descriptor.m_binWidth = binWidth;
+    descriptor.m_fftSize = fftSize;
+    int32_t useWindow = int32_t(segment.m_useBandWidth * fftSize / 2.0);
+    float powerThreshold = this->m_powerThreshold;
+    if (!std::isnan(segment.m_threshold)) {
+      powerThreshold = pow(10.0, segment.m_threshold / 5);
+    }
+    thresholds.resize(fftSize);
+    for (int32_t bin = -halfSampleCount; bin < halfSampleCount; bin++) {
+      thresholds[bin + halfSampleCount] = abs(bin) <= useWindow ? powerThreshold : INFINITY;
+    }
+    auto setBand = [&](double startFrequency, double stopFrequency, float threshold) {
+      double first = ceil((startFrequency - descriptor.m_startFrequency) / binWidth);
+      double last = floor((stopFrequency - descriptor.m_startFrequency) / binWidth);
+      first = std::max(first, 0.0);
+      last = std::min(last, double(fftSize - 1));
+      for (int32_t index = int32_t(first); index <= int32_t(last); index++) {
+        if (!std::isinf(thresholds[index])) {
+          thresholds[index] = threshold;
+        }
+      }
+    };
+    for (auto & band : this->m_bandThresholds) {
+      setBand(band.m_startFrequency, band.m_stopFrequency, band.m_powerThreshold);
+    }
+    for (auto & exclusion : segment.m_exclusions) {
+      setBand(exclusion.first, exclusion.second, INFINITY);
+    }
+    for (auto & spur : stepSpurs[step]) {
+      if (spur.m_bin >= -halfSampleCount && spur.m_bin < halfSampleCount) {
+        float & threshold = thresholds[spur.m_bin + halfSampleCount];
+        threshold = std::max(threshold, float(pow(10.0, (spur.m_level + this->m_spurMargin) / 5)));
+      }
+    }
+    float minimumThreshold = INFINITY;
+    for (auto & span : usedSpans) {
+      for (int32_t bin = span.m_firstBin; bin <= span.m_lastBin; bin++) {
+        float threshold = thresholds[bin + halfSampleCount];
+        if (std::isinf(threshold)) {
+          continue;
+        }
+        minimumThreshold = std::min(minimumThreshold, threshold);
+        std::vector<BinSpan> & spans = descriptor.m_spans;
+        if (!spans.empty() 
+            && bin != 0
+            && spans.back().m_lastBin == bin - 1 
+            && spans.back().m_powerThreshold == threshold) {
+          spans.back().m_lastBin = bin;
+        } else {
+          spans.push_back(BinSpan{bin, bin, threshold});
+        }
+      }
+    }
+    // Gate the step on its lowest bin threshold rather than the global one,
+    // so a band threshold below the global threshold still gets its blocks
+    // past the energy and coarse stages.
+    descriptor.m_energyThreshold = 
+      minimumThreshold / (window->GetEnergy() * this->m_passbandMaximum);
+    double gainRatio = this->m_fftWindow.GetCoherentGain() / window->GetCoherentGain();
+    descriptor.m_coarseThresholdScale = 
+      minimumThreshold / this->m_powerThreshold * gainRatio * gainRatio;
+    frequencyTable->SetProcessInfoForIndex(step, &descriptor);
+  }
+  for (auto & entry : this->m_transformPlans) {
+    printf("FFT size %u for some steps\n", entry.first);
+  }
+}
+
+void ProcessSamples::SetTimeDomainWindow(uint32_t window)
+{
+  assert(window >= 1 && window <= this->m_sampleCount);
+  this->m_timeDomainWindow = window;
+}
+
+// The zoom resolves the sample rate / (decimation * m_sampleCount), which
+// takes decimation blocks of samples, and more for the filter transient.
+// The filters and the FFT plan are made here, since the FFTW planner must
+// not run alongside the workers.
+//
+void ProcessSamples::SetZoomDecimation(uint32_t decimation)
+{
+  this->m_zoomDecimation = decimation;
+  if (decimation <= 1) {
+    return;
+  }
+  uint32_t zoomSize = this->m_sampleCount;
+  this->m_zoomFFT = new FFT(zoomSize);
+  this->m_zoomWindow = new FFTWindow(this->m_fftWindow.m_type, zoomSize);
+  for (uint32_t threadId = 0; threadId < this->m_threadCount; threadId++) {
+    this->m_zoomDownconverters[threadId] = 
+      new Downconverter(this->m_sampleRate, 0.0, this->m_sampleRate / (2.0 * decimation));
+  }
+  uint32_t transientSamples = this->m_zoomDownconverters[0]->GetTransientCount() * decimation;
+  this->m_zoomBlockCount = 
+    decimation + (transientSamples + this->m_sampleCount - 1) / this->m_sampleCount;
+  for (uint32_t threadId = 0; threadId < this->m_threadCount; threadId++) {
+    this->m_zoomSamples[threadId] = fftwf_alloc_complex(this->m_zoomBlockCount * this->m_sampleCount);
+    this->m_zoomBuffer[threadId] = fftwf_alloc_complex(2 * zoomSize);
+  }
+}
+
+// Window the thread's input samples, folding them down to the FFT size with
+// a polyphase window, and transform them into its FFT output buffer. Blocks
+// of a segment with its own FFT size use that size's plan.
+//
+void ProcessSamples::Transform(uint32_t threadId, uint32_t sampleCount)
+{
+  if (sampleCount != this->m_sampleCount) {
+    TransformPlan & plan = this->m_transformPlans.at(sampleCount);
+    plan.m_window->apply(this->m_inputSamples[threadId]);
+    plan.m_fft->execute(this->m_fftOutputBuffer[threadId], this->m_inputSamples[threadId]);
+    return;
+  }
+  this->m_fftWindow.apply(this->m_inputSamples[threadId]);
+  if (this->m_prunedFFT != nullptr) {
+    this->m_prunedFFT->execute(this->m_fftOutputBuffer[threadId],
+                               this->m_inputSamples[threadId],
+                               this->m_prunedBuffer[threadId]);
+  } else {
+    this->m_fft.execute(this->m_fftOutputBuffer[threadId], 
+                        this->m_inputSamples[threadId]);
+  }
+}
+
+// The coarse stage transforms coarseSize sample segments of the block that
+// overlap by half, so a burst no longer than half a segment lies within the
+// middle half of one of them, away from the tapered edges of the window. A
+// tone gives a coarse magnitude that is the fine one scaled by the ratio of
+// the window gains, so the coarse threshold is the fine threshold less
+// margin dB, which covers scalloping and the taper of the middle half.
+//
+void ProcessSamples::SetCoarseDetection(uint32_t coarseSize, float margin)
+{
+  assert(this->m_mode == FrequencyDomain);
+  assert(coarseSize >= 2 && this->m_fftSize % coarseSize == 0);
+  this->m_coarseFFT = new FFT(coarseSize);
+  this->m_coarseWindow = new FFTWindow(this->m_fftWindow.m_type, coarseSize);
+  double gainRatio = this->m_fftWindow.GetCoherentGain() / this->m_coarseWindow->GetCoherentGain();
+  this->m_coarsePowerThreshold = 
+    pow(10.0, (this->m_threshold - margin) / 5) / (gainRatio * gainRatio * this->m_passbandMaximum);
+  for (uint32_t threadId = 0; threadId < this->m_threadCount; threadId++) {
+    this->m_coarseBuffer[threadId] = fftwf_alloc_complex(2 * coarseSize);
+  }
+}
+
+// Fill the thread's power buffer with the linear power of the used band of
+// an FFT of fftSize, from the lowest to the highest frequency bin.
+//
+void ProcessSamples::ComputePowers(uint32_t threadId, uint32_t fftSize, const float * passband)
+{
+  uint32_t binCount = this->GetSpectrumBinCount(fftSize);
+  uint32_t usedBins = binCount / 2;
+  std::vector<float> & powers = this->m_powers[threadId];
+  powers.resize(binCount);
+  lv_32fc_t * spectrum = reinterpret_cast<lv_32fc_t *>(this->m_fftOutputBuffer[threadId]);
+  if (this->m_prunedFFT != nullptr && fftSize == this->m_fftSize) {
+    volk_32fc_magnitude_squared_32f(&powers[0], spectrum, binCount);
+  } else {
+    volk_32fc_magnitude_squared_32f(&powers[0], 
+                                    spectrum + fftSize - usedBins, 
+                                    usedBins);
+    volk_32fc_magnitude_squared_32f(&powers[usedBins], spectrum, usedBins + 1);
+  }
+  if (passband != nullptr) {
+    volk_32f_x2_multiply_32f(&powers[0], 
+                             &powers[0], 
+                             &passband[fftSize / 2 - usedBins], 
+                             binCount);
+  }
+}
+
+void ProcessSamples::AddAccumulator(SpectrumAccumulator * accumulator)
+{
+  assert(this->m_mode == FrequencyDomain);
+  this->m_accumulators.push_back(accumulator);
+}
+
+// The FFT size of a step, that of its frequency plan segment if it has one.
+//
+uint32_t ProcessSamples::GetStepFFTSize(uint32_t step)
+{
+  uint32_t sampleCount = this->m_frequencyTable->GetSegmentFromIndex(step).m_sampleCount;
+  if (sampleCount != 0 && sampleCount != this->m_sampleCount) {
+    return sampleCount;
+  }
+  return this->m_fftSize;
+}
+
+// The bins of the used band of an FFT of fftSize, with the use window
+// scaled to that size.
+//
+uint32_t ProcessSamples::GetSpectrumBinCount(uint32_t fftSize)
+{
+  uint32_t useWindow = uint64_t(this->m_useWindow) * fftSize / this->m_fftSize;
+  return 2 * std::min(useWindow, fftSize / 2 - 1) + 1;
+}
+
+// The spectrum the accumulators are fed for each step of the frequency
+// table.
+//
+std::vector<SpectrumAccumulator::StepSpectrum> ProcessSamples::GetStepSpectra()
+{
+  assert(this->m_frequencyTable != nullptr);
+  uint32_t stepCount = this->m_frequencyTable->GetFrequencyCount();
+  std::vector<SpectrumAccumulator::StepSpectrum> stepSpectra(stepCount);
+  for (uint32_t step = 0; step < stepCount; step++) {
+    uint32_t fftSize = this->GetStepFFTSize(step);
+    stepSpectra[step] = SpectrumAccumulator::StepSpectrum{this->GetSpectrumBinCount(fftSize),
+                                                          double(this->m_sampleRate) / fftSize};
+  }
+  return stepSpectra;
+}
+
+// The threshold as a linear power, for the accumulators.
+//
+float ProcessSamples::GetPowerThreshold()
+{
+  return this->m_powerThreshold;
 }
 
 void ProcessSamples::WriteToFile(const char * fileName, fftwf_complex * data)
@@ -136,10 +849,10 @@ void ProcessSamples::Run(int16_t sample_buffer[][2], uint32_t centerFrequency)
                                           this->m_enob,
                                           this->m_correctDCOffset);
   if (this->m_mode == FrequencyDomain) {
-    this->m_fftWindow.apply(this->m_inputSamples[0]);
-    this->m_fft.process(this->m_fftOutputBuffer[0], this->m_inputSamples[0]);
+    this->Transform(0, this->m_sampleCount);
     // TODO: Materialize a MessageHeader struct here.
-    this->process_fft(this->m_fftOutputBuffer[0], nullptr);
+    Detection detection{};
+    this->process_fft(this->m_fftOutputBuffer[0], nullptr, detection);
   }
 }
 
@@ -170,14 +883,33 @@ std::string ProcessSamples::GenerateFileName(std::string fileNameBase,
   return std::string(buffer);
 }
 
-void ProcessSamples::WriteSamplesToFile(uint64_t sequenceId, double centerFrequency)
+void ProcessSamples::WriteSamplesToFile(uint64_t sequenceId, 
+                                        double centerFrequency,
+                                        const Detection & detection,
+                                        uint32_t stepIndex)
 {
   assert(this->m_sampleQueue != nullptr);
   time_t startTime;
   startTime = time(NULL);
   std::string fileName = this->GenerateFileName(this->m_fileNameBase, startTime, centerFrequency);
-  uint64_t decrement = std::min<uint64_t>(sequenceId, this->m_preTrigger);
-  this->m_sampleQueue->BeginWrite(sequenceId - decrement, fileName);
+  uint64_t startSequenceId = sequenceId - std::min<uint64_t>(sequenceId, this->m_preTrigger);
+  uint32_t writeStepIndex = SampleQueue::s_allSteps;
+  if (this->m_dwellSource != nullptr) {
+    startSequenceId = this->m_sampleQueue->GetPrecedingSequenceId(sequenceId, 
+                                                                  stepIndex, 
+                                                                  this->m_preTrigger);
+    writeStepIndex = stepIndex;
+  }
+  Downconverter * downconverter = nullptr;
+  if (this->m_writeNarrowband && detection.m_bandWidth > 0.0) {
+    // Leave a few bins of margin around the detected band.
+    double binWidth = double(this->m_sampleRate) / this->m_fftSize;
+    downconverter = new Downconverter(this->m_sampleRate,
+                                      detection.m_frequency - centerFrequency,
+                                      detection.m_bandWidth + 4 * binWidth);
+    downconverter->WriteHeader(fileName + ".txt", centerFrequency);
+  }
+  this->m_sampleQueue->BeginWrite(startSequenceId, fileName, downconverter, writeStepIndex);
 }
 
 void ProcessSamples::RecordSamples(SignalSource * signalSource, 
@@ -200,40 +932,309 @@ void ProcessSamples::RecordSamples(SignalSource * signalSource,
    }
 }
 
+// Sums of window consecutive values, sums[k] over values[k] to
+// values[k + window - 1], for each of the length - window + 1 windows. The
+// sums over 1, 2, 4, ... values are built by doubling, and those of the set
+// bits of window added up, so every pass is a vector add.
+//
+static void SlidingSums(const float * values,
+                        uint32_t length,
+                        uint32_t window,
+                        float * sums,
+                        std::vector<float> * partials)
+{
+  uint32_t count = length - window + 1;
+  std::fill(sums, sums + count, 0.0f);
+  // partial[i] is the sum of the span values from values[i] on.
+  const float * partial = values;
+  uint32_t next = 0;
+  uint32_t offset = 0;
+  for (uint32_t span = 1; span <= window; span *= 2) {
+    if (window & span) {
+      volk_32f_x2_add_32f(sums, sums, partial + offset, count);
+      offset += span;
+    }
+    if (2 * span <= window) {
+      std::vector<float> & doubled = partials[next];
+      doubled.resize(length);
+      volk_32f_x2_add_32f(&doubled[0], partial, partial + span, length - 2 * span + 1);
+      partial = &doubled[0];
+      next = 1 - next;
+    }
+  }
+}
+
+// Sliding window energy detector. The mean sample power over the last
+// m_timeDomainWindow samples is compared with the threshold in the linear
+// domain. The window slides on from the block just before in sequence at
+// the same frequency, so bursts straddling two blocks are caught, and each
+// burst is reported with its first and last sample offsets once it ends,
+// or when processing ends. The window sums are computed before the state of
+// the frequency is taken, then the block waits for the previous one of its
+// frequency, so workers only serialize on the same frequency and the state
+// advances in order.
+//
 bool ProcessSamples::DoTimeDomainThresholding(fftwf_complex * inputSamples,
-                                              SampleQueue::MessageHeader * header)
-{
-  double log10 = log2(10);
-  float maxMagnitude = std::numeric_limits<float>::min();
-  float minMagnitude = std::numeric_limits<float>::max();
-  bool allZeros = true;
-  float maxre = std::numeric_limits<float>::min();
-  float maxim = std::numeric_limits<float>::min();
-  for (uint32_t i = 0; i < this->m_sampleCount; i++) {
-    float re = inputSamples[i][0];
-    float im = inputSamples[i][1];
-    if (re != 0.0 || im != 0.0) {
-      allZeros = false;
-    }
-    maxre = std::max(maxre, re);
-    maxim = std::max(maxim, im);
-    float mag = sqrt(re * re + im * im); // / this->m_sampleCount;
-    float magnitude = 10 * log2(mag) / log10;
-    maxMagnitude = std::max(maxMagnitude, magnitude);
-    minMagnitude = std::min(minMagnitude, magnitude);
-  }  
-  
-  if (maxMagnitude >= this->m_threshold) {
-    printf("Sequence[%llu]: ", header->m_sequenceId);
-    printf("Max signal %f above threshold %f frequency %.0f, min %f\n", 
-           maxMagnitude, 
-           this->m_threshold,
-           header->m_frequency,
-           minMagnitude);
-    //printf("Max re[%f], im[%f]\n", maxre, maxim);
-    return true;
-  }
-  return false;
+                                              SampleQueue::MessageHeader * header,
+                                              uint32_t threadId)
+{
+  uint32_t window = this->m_timeDomainWindow;
+  uint32_t count = this->m_sampleCount;
+  uint32_t length = window - 1 + count;
+  std::vector<float> & powers = this->m_timeDomainPowers[threadId];
+  std::vector<float> & sums = this->m_timeDomainSums[threadId];
+  // powers holds window - 1 zeros in place of the carried powers, then the
+  // block. sums[k] is the window ending at sample k of the block.
+  powers.resize(length);
+  sums.resize(count);
+  std::fill(powers.begin(), powers.begin() + window - 1, 0.0f);
+  volk_32fc_magnitude_squared_32f(&powers[window - 1], 
+                                  reinterpret_cast<lv_32fc_t *>(inputSamples), 
+                                  count);
+  SlidingSums(&powers[0], length, window, &sums[0], this->m_timeDomainPartials[threadId]);
+  float windowThreshold = this->m_powerThreshold * window;
+  uint64_t firstSample = header->m_sequenceId * count;
+  bool trigger = false;
+
+  TimeDomainState * state;
+  {
+    std::unique_lock<std::mutex> locker(this->m_timeDomainStatesMutex);
+    state = &this->m_timeDomainStates[header->m_frequency];
+  }
+  std::unique_lock<std::mutex> locker(state->m_mutex);
+  // The previous block was taken from the queue earlier, by another worker.
+  while (state->m_lastSequenceId != header->m_previousSequenceId) {
+    state->m_condition.wait(locker);
+  }
+  uint32_t first = 0;
+  if (header->m_previousSequenceId != SampleQueue::s_noSequenceId 
+      && header->m_previousSequenceId + 1 == header->m_sequenceId) {
+    // Add the carried powers to the windows straddling the two blocks.
+    float carried = 0.0;
+    for (int32_t k = int32_t(window) - 2; k >= 0; k--) {
+      carried += state->m_tail[k];
+      sums[k] += carried;
+    }
+  } else {
+    if (state->m_inBurst) {
+      this->ReportBurst(header->m_frequency, *state);
+      state->m_inBurst = false;
+    }
+    first = window - 1;
+  }
+  uint32_t peakIndex;
+  volk_32f_index_max_32u(&peakIndex, &sums[first], count - first);
+  if (sums[first + peakIndex] <= windowThreshold) {
+    if (state->m_inBurst) {
+      this->ReportBurst(header->m_frequency, *state);
+      state->m_inBurst = false;
+    }
+  } else {
+    for (uint32_t k = first; k < count; k++) {
+      uint64_t end = firstSample + k;
+      if (sums[k] > windowThreshold) {
+        if (!state->m_inBurst) {
+          state->m_inBurst = true;
+          state->m_burstStart = end + 1 - window;
+          state->m_burstPeak = 0.0;
+        }
+        state->m_burstEnd = end;
+        state->m_burstPeak = std::max(state->m_burstPeak, double(sums[k]) / window);
+        trigger = true;
+      } else if (state->m_inBurst) {
+        this->ReportBurst(header->m_frequency, *state);
+        state->m_inBurst = false;
+      }
+    }
+  }
+  state->m_tail.assign(powers.end() - (window - 1), powers.end());
+  state->m_lastSequenceId = header->m_sequenceId;
+  locker.unlock();
+  state->m_condition.notify_all();
+  return trigger;
+}
+
+void ProcessSamples::ReportBurst(double frequency, const TimeDomainState & state)
+{
+  printf("burst start %lu end %lu frequency %.0f power_db %f\n",
+         state.m_burstStart,
+         state.m_burstEnd,
+         frequency,
+         5 * log10(state.m_burstPeak));
+}
+
+bool ProcessSamples::DoCorrelation(fftwf_complex * inputSamples,
+                                   SampleQueue::MessageHeader * header,
+                                   uint32_t threadId)
+{
+  assert(this->m_correlator != nullptr);
+  // The correlator needs the spectrum of the unwindowed block.
+  memcpy(this->m_inputSamples[threadId], 
+         inputSamples, 
+         sizeof(fftwf_complex)*this->m_sampleCount);
+  this->m_fft.execute(this->m_fftOutputBuffer[threadId], 
+                      this->m_inputSamples[threadId]);
+  std::vector<Correlator::Peak> peaks;
+  this->m_correlator->Correlate(this->m_fftOutputBuffer[threadId],
+                                this->m_inputSamples[threadId],
+                                this->m_sampleCount,
+                                this->m_correlationBuffer[threadId],
+                                peaks);
+  for (auto & peak : peaks) {
+    uint64_t offset = header->m_sequenceId * this->m_sampleCount + peak.m_offset;
+    printf("freq %lu template %s offset %lu score %f\n", 
+           uint64_t(header->m_frequency),
+           this->m_correlator->GetTemplateName(peak.m_templateIndex).c_str(),
+           offset,
+           peak.m_score);
+  }
+  return !peaks.empty();
+}
+
+// Find the coarse bins above the coarse threshold in any of the half
+// overlapping segments of the block, widened by a coarse bin on each side,
+// and return the fine bins they cover. Returns false when there are none and
+// the fine stage can be skipped. thresholdScale lowers the threshold for
+// steps whose lowest threshold is below the global one.
+//
+bool ProcessSamples::DoCoarseDetection(fftwf_complex * inputSamples,
+                                       uint32_t threadId,
+                                       float thresholdScale,
+                                       std::vector<BinRange> & ranges)
+{
+  float coarsePowerThreshold = this->m_coarsePowerThreshold * thresholdScale;
+  int32_t coarseSize = this->m_coarseFFT->getSize();
+  int32_t ratio = this->m_fftSize / coarseSize;
+  fftwf_complex * segment = this->m_coarseBuffer[threadId];
+  fftwf_complex * spectrum = segment + coarseSize;
+  float powers[coarseSize];
+  bool flags[coarseSize + 2];
+  memset(flags, 0, sizeof(flags));
+  for (uint32_t offset = 0; offset + coarseSize <= this->m_sampleCount; offset += coarseSize / 2) {
+    memcpy(segment, inputSamples + offset, sizeof(fftwf_complex) * coarseSize);
+    this->m_coarseWindow->apply(segment);
+    this->m_coarseFFT->execute(spectrum, segment);
+    volk_32fc_magnitude_squared_32f(powers, reinterpret_cast<lv_32fc_t *>(spectrum), coarseSize);
+    // flags[1 + c] is signed coarse bin c - coarseSize / 2.
+    for (int32_t c = 0; c < coarseSize; c++) {
+      if (powers[c] > coarsePowerThreshold) {
+        flags[1 + (c + coarseSize / 2) % coarseSize] = true;
+      }
+    }
+  }
+  ranges.clear();
+  for (int32_t c = 0; c < coarseSize; c++) {
+    if (!(flags[c] || flags[c + 1] || flags[c + 2])) {
+      continue;
+    }
+    int32_t center = (c - coarseSize / 2) * ratio;
+    if (!ranges.empty() && ranges.back().second == center - ratio / 2 - 1) {
+      ranges.back().second = center + (ratio - 1) / 2;
+    } else {
+      ranges.push_back(BinRange(center - ratio / 2, center + (ratio - 1) / 2));
+    }
+  }
+  return !ranges.empty();
+}
+
+// Refine a detection with a zoom FFT: mix the captured samples down to the
+// detection center, decimate and transform. The zoom only improves on the
+// full FFT with m_zoomBlockCount contiguous blocks at the frequency, this
+// one and those captured just before it, so without them there is no zoom.
+//
+void ProcessSamples::DoZoom(fftwf_complex * inputSamples,
+                            SampleQueue::MessageHeader * header,
+                            uint32_t threadId,
+                            Detection & detection)
+{
+  uint32_t sampleCount = this->m_sampleCount;
+  uint32_t precedingCount = this->m_zoomBlockCount - 1;
+  fftwf_complex * samples = this->m_zoomSamples[threadId];
+  if (this->m_sampleQueue->CopyPrecedingSamples(header->m_sequenceId,
+                                                header->m_frequency,
+                                                precedingCount,
+                                                samples) < precedingCount) {
+    return;
+  }
+  memcpy(samples + precedingCount * sampleCount, 
+         inputSamples, 
+         sizeof(fftwf_complex) * sampleCount);
+  Downconverter * downconverter = this->m_zoomDownconverters[threadId];
+  downconverter->Reset(detection.m_frequency - header->m_frequency);
+  std::vector<lv_32fc_t> & zoomed = this->m_zoomOutput[threadId];
+  downconverter->Process(samples, this->m_zoomBlockCount * sampleCount, zoomed);
+  // Use the newest samples, past the start up transient of the filters.
+  uint32_t zoomSize = this->m_zoomFFT->getSize();
+  assert(zoomed.size() >= downconverter->GetTransientCount() + zoomSize);
+  fftwf_complex * buffer = this->m_zoomBuffer[threadId];
+  memcpy(buffer, &zoomed[zoomed.size() - zoomSize], sizeof(fftwf_complex) * zoomSize);
+  this->m_zoomWindow->apply(buffer);
+  this->m_zoomFFT->execute(buffer + zoomSize, buffer);
+  // The windowed samples are done with, so their half holds the magnitudes.
+  float * magnitudes = reinterpret_cast<float *>(buffer);
+  Utility::complex_to_magnitude(buffer + zoomSize, magnitudes, zoomSize);
+
+  // Only the central half of the decimated band is free of aliases.
+  double resolution = downconverter->GetOutputRate() / zoomSize;
+  int32_t quarter = zoomSize / 4;
+  int32_t peak = 0;
+  for (int32_t k = -quarter; k <= quarter; k++) {
+    if (magnitudes[(k + zoomSize) % zoomSize] > magnitudes[(peak + zoomSize) % zoomSize]) {
+      peak = k;
+    }
+  }
+  detection.m_zoomFrequency = detection.m_frequency + peak * resolution;
+  detection.m_zoomResolution = resolution;
+  detection.m_zoomPower = magnitudes[(peak + zoomSize) % zoomSize];
+  printf("zoom freq %lu resolution %f power_db %f blocks %u\n",
+         uint64_t(detection.m_zoomFrequency),
+         resolution,
+         detection.m_zoomPower,
+         this->m_zoomBlockCount);
+}
+
+bool ProcessSamples::DoChannelization(fftwf_complex * inputSamples,
+                                      SampleQueue::MessageHeader * header,
+                                      uint32_t threadId)
+{
+  assert(this->m_channelizer != nullptr);
+  Channelizer * channelizer = this->m_channelizer;
+  uint32_t outputCount = channelizer->GetOutputCount(this->m_sampleCount);
+  uint32_t selectedCount = channelizer->GetSelectedCount();
+  double channelRate = double(this->m_sampleRate) / channelizer->GetDecimation();
+  fftwf_complex channels[selectedCount * outputCount];
+  channelizer->Process(inputSamples,
+                       this->m_sampleCount,
+                       this->m_channelizerBuffer[threadId],
+                       channels);
+  bool trigger = false;
+  for (uint32_t c = 0; c < selectedCount; c++) {
+    fftwf_complex * samples = &channels[c * outputCount];
+    float power = 0.0;
+    for (uint32_t i = 0; i < outputCount; i++) {
+      power += samples[i][0] * samples[i][0] + samples[i][1] * samples[i][1];
+    }
+    float powerDb = 10 * log10(power / outputCount);
+    if (powerDb < this->m_channelThreshold) {
+      continue;
+    }
+    uint32_t channel = channelizer->GetSelectedChannel(c);
+    double frequency = header->m_frequency 
+      + channelizer->GetChannelOffset(channel, this->m_sampleRate);
+    printf("channel %u freq %lu power_db %f\n", channel, uint64_t(frequency), powerDb);
+    trigger = true;
+    if (this->m_channelFile != nullptr) {
+      Channelizer::RecordHeader recordHeader{header->m_sequenceId, 
+                                             frequency, 
+                                             channelRate, 
+                                             channel, 
+                                             outputCount};
+      std::unique_lock<std::mutex> locker(this->m_channelFileMutex);
+      fwrite(&recordHeader, sizeof(recordHeader), 1, this->m_channelFile);
+      fwrite(samples, sizeof(fftwf_complex), outputCount, this->m_channelFile);
+    }
+  }
+  return trigger;
 }
 
 void ProcessSamples::UpdateEndSequenceId(uint64_t newEndSequenceId)
@@ -249,7 +1250,8 @@ void ProcessSamples::UpdateEndSequenceId(uint64_t newEndSequenceId)
 
 void ProcessSamples::ProcessWrite(bool doWrite, 
                                   double centerFrequency,
-                                  uint64_t sequenceId)
+                                  uint64_t sequenceId,
+                                  const Detection & detection)
 {
   if (this->m_writing) {
     if (doWrite) {
@@ -261,7 +1263,7 @@ void ProcessSamples::ProcessWrite(bool doWrite,
     }
   } else if (doWrite) {
     if (this->m_fileNameBase != "") {
-      this->WriteSamplesToFile(sequenceId, centerFrequency);
+      this->WriteSamplesToFile(sequenceId, centerFrequency, detection, SampleQueue::s_allSteps);
       this->m_writing = true;
       uint64_t newEndSequenceId = sequenceId + this->m_postTrigger + 1;
       this->UpdateEndSequenceId(newEndSequenceId);
@@ -269,6 +1271,52 @@ void ProcessSamples::ProcessWrite(bool doWrite,
   }
 }
 
+// The sweep mode recording. Blocks of other steps, and those processed out
+// of order before the trigger, are left to the writer's step filter.
+//
+void ProcessSamples::ProcessStepWrite(bool doWrite, 
+                                      double centerFrequency,
+                                      uint32_t stepIndex,
+                                      uint64_t sequenceId,
+                                      const Detection & detection)
+{
+  std::unique_lock<std::mutex> locker(this->m_stepWriteMutex);
+  if (this->m_writing) {
+    if (stepIndex != this->m_writeStepIndex || sequenceId < this->m_writeTriggerSequenceId) {
+      return;
+    }
+    if (doWrite) {
+      // Keep holding the step while it triggers.
+      this->m_postRemaining = this->m_postTrigger;
+      this->m_dwellSource->RequestDwell(stepIndex, this->m_dwellCaptures);
+    } else if (this->m_postRemaining > 0) {
+      this->m_postRemaining--;
+    }
+  } else if (doWrite && this->m_fileNameBase != "") {
+    this->WriteSamplesToFile(sequenceId, centerFrequency, detection, stepIndex);
+    this->m_writing = true;
+    this->m_writeStepIndex = stepIndex;
+    this->m_writeTriggerSequenceId = sequenceId;
+    this->m_postRemaining = this->m_postTrigger;
+    this->m_dwellSource->RequestDwell(stepIndex, this->m_dwellCaptures);
+  } else {
+    return;
+  }
+  if (this->m_postRemaining == 0) {
+    this->m_sampleQueue->EndWrite(sequenceId + 1);
+    this->m_writing = false;
+  }
+}
+
+void ProcessSamples::FinishStepWrite(uint64_t sequenceId)
+{
+  std::unique_lock<std::mutex> locker(this->m_stepWriteMutex);
+  if (this->m_writing) {
+    this->m_sampleQueue->EndWrite(sequenceId + 1);
+    this->m_writing = false;
+  }
+}
+
 void ProcessSamples::ThreadWorker(uint32_t threadId)
 {
   double centerFrequency;
@@ -287,35 +1335,118 @@ void ProcessSamples::ThreadWorker(uint32_t threadId)
     }
     sequenceId = message->GetHeader().m_sequenceId;
     double centerFrequency = message->GetHeader().m_frequency;
+    uint32_t sampleCount = message->GetHeader().m_sampleCount;
+    Detection detection{};
+    if (this->m_tuneOffset != 0.0) {
+      // Shift the step frequency from the tuning offset back to DC, in place
+      // so recordings are centered on the step frequency too.
+      lv_32fc_t phase(1.0, 0.0);
+      volk_32fc_s32fc_x2_rotator_32fc(reinterpret_cast<lv_32fc_t *>(message->GetData()),
+                                      reinterpret_cast<lv_32fc_t *>(message->GetData()),
+                                      this->m_tunePhaseIncrement,
+                                      &phase,
+                                      sampleCount);
+    }
     if (this->m_mode == TimeDomain) {
-      doWrite = this->DoTimeDomainThresholding(message->GetData(), &message->m_header);
+      doWrite = this->DoTimeDomainThresholding(message->GetData(), 
+                                               &message->m_header,
+                                               threadId);
     } else if (this->m_mode == FrequencyDomain) {
-      memcpy(this->m_inputSamples[threadId], 
-             message->GetData(), 
-             sizeof(fftwf_complex)*this->m_sampleCount);
-      this->m_fftWindow.apply(this->m_inputSamples[threadId]);
-      this->m_fft.process(this->m_fftOutputBuffer[threadId], 
-                          this->m_inputSamples[threadId]);
-      doWrite = this->process_fft(this->m_fftOutputBuffer[threadId], &message->m_header);
+      std::vector<BinRange> ranges;
+      doWrite = false;
+      float energyThreshold = this->m_energyThreshold;
+      float coarseThresholdScale = 1.0;
+      const StepDescriptor * descriptor = nullptr;
+      if (!this->m_stepDescriptors.empty()) {
+        descriptor = &this->m_stepDescriptors[message->m_header.m_stepIndex];
+        energyThreshold = descriptor->m_energyThreshold;
+        coarseThresholdScale = descriptor->m_coarseThresholdScale;
+      }
+      lv_32fc_t energy;
+      volk_32fc_x2_conjugate_dot_prod_32fc(&energy,
+                                           reinterpret_cast<lv_32fc_t *>(message->GetData()),
+                                           reinterpret_cast<lv_32fc_t *>(message->GetData()),
+                                           sampleCount);
+      // The accumulators need the spectrum of every block.
+      bool accumulate = !this->m_accumulators.empty();
+      if (!this->m_calibrationSums.empty()) {
+        memcpy(this->m_inputSamples[threadId], 
+               message->GetData(), 
+               sizeof(fftwf_complex)*this->m_sampleCount);
+        this->Calibrate(threadId);
+      } else if (!accumulate && lv_creal(energy) <= energyThreshold) {
+        this->m_skippedBlocks++;
+      } else if (!accumulate 
+                 && this->m_coarseFFT != nullptr 
+                 && !this->DoCoarseDetection(message->GetData(), 
+                                             threadId, 
+                                             coarseThresholdScale,
+                                             ranges)) {
+        this->m_coarseSkippedBlocks++;
+      } else {
+        this->m_processedBlocks++;
+        memcpy(this->m_inputSamples[threadId], 
+               message->GetData(), 
+               sizeof(fftwf_complex)*sampleCount);
+        this->Transform(threadId, sampleCount);
+        doWrite = this->process_fft(this->m_fftOutputBuffer[threadId], 
+                                    &message->m_header, 
+                                    detection,
+                                    ranges.empty() ? nullptr : &ranges);
+        if (accumulate) {
+          // Accumulators need the frequency table, so there is a descriptor.
+          this->ComputePowers(threadId, descriptor->m_fftSize, descriptor->m_passband);
+          for (auto accumulator : this->m_accumulators) {
+            accumulator->Update(message->m_header.m_stepIndex, 
+                                sequenceId, 
+                                &this->m_powers[threadId][0]);
+          }
+        }
+      }
+      if (detection.m_binCount > 0 && this->m_frequencyTable != nullptr) {
+        this->m_frequencyTable->ReportActivity(message->m_header.m_stepIndex);
+      }
+      if (this->m_zoomDecimation > 1 && detection.m_binCount > 0) {
+        this->DoZoom(message->GetData(), &message->m_header, threadId, detection);
+      }
+    } else if (this->m_mode == Correlation) {
+      doWrite = this->DoCorrelation(message->GetData(), &message->m_header, threadId);
+    }
+    if (this->m_channelizer != nullptr) {
+      // Channel detections are recorded narrowband by the channelizer.
+      this->DoChannelization(message->GetData(), &message->m_header, threadId);
     }
     // printf("Sequence[%llu] frequency[%f] doWrite[%d]\n", 
     //       sequenceId, centerFrequency, doWrite);
     if (doWrite) {
       fflush(stdout);
+    }
+    if (this->m_dwellSource != nullptr) {
+      this->ProcessStepWrite(doWrite, 
+                             centerFrequency, 
+                             message->m_header.m_stepIndex, 
+                             sequenceId, 
+                             detection);
     } else {
-      this->m_sampleQueue->SendAck();
+      this->ProcessWrite(doWrite, centerFrequency, sequenceId, detection);
     }
-    this->ProcessWrite(doWrite, centerFrequency, sequenceId);
     this->m_sampleQueue->MessageProcessed(message);
   }
   // Shutdown writing gracefully.
+  if (this->m_dwellSource != nullptr) {
+    this->FinishStepWrite(sequenceId);
+    return;
+  }
   this->UpdateEndSequenceId(sequenceId);
-  this->ProcessWrite(false, centerFrequency, sequenceId);
+  this->ProcessWrite(false, centerFrequency, sequenceId, Detection{});
 }
 
 bool ProcessSamples::StartProcessing(SampleQueue & sampleQueue)
 {
   this->m_sampleQueue = &sampleQueue;
+  if (this->m_mode == FrequencyDomain && this->m_frequencyTable != nullptr) {
+    this->BuildStepDescriptors();
+  }
   for (uint32_t threadId = 0; threadId < this->m_threadCount; threadId++) {
     printf("Starting process thread %u\n", threadId);
     this->m_threads[threadId] = new std::thread(&ProcessSamples::ThreadWorker, 
@@ -326,7 +1457,45 @@ bool ProcessSamples::StartProcessing(SampleQueue & sampleQueue)
     this->m_threads[threadId]->join();
     printf("Stopped process thread %u\n", threadId);
   }
+  // Report the bursts still open when the samples ran out.
+  for (auto & entry : this->m_timeDomainStates) {
+    if (entry.second.m_inBurst) {
+      this->ReportBurst(entry.first, entry.second);
+    }
+  }
+  this->Finish();
 
   return true;
 }
 
+void ProcessSamples::Finish()
+{
+  if (this->m_finished.exchange(true)) {
+    return;
+  }
+  if (!this->m_calibrationSums.empty()) {
+    this->WriteCalibration();
+  }
+  for (auto accumulator : this->m_accumulators) {
+    accumulator->Finish();
+  }
+}
+
+void ProcessSamples::ReportStatistics()
+{
+  uint64_t skipped = this->m_skippedBlocks;
+  uint64_t coarseSkipped = this->m_coarseSkippedBlocks;
+  uint64_t processed = this->m_processedBlocks;
+  uint64_t total = skipped + coarseSkipped + processed;
+  if (total > 0) {
+    fprintf(stderr, 
+            "Blocks processed %lu, skipped below energy threshold %lu (%.1f%%), "
+            "skipped by coarse stage %lu (%.1f%%)\n",
+            processed,
+            skipped,
+            100.0 * skipped / total,
+            coarseSkipped,
+            100.0 * coarseSkipped / total);
+  }
+}
+
@@ -2,71 +2,298 @@
 #pragma once
 
 #include <time.h>
+#include <map>
+#include <vector>
+#include <mutex>
+#include <condition_variable>
 #include <gnuradio/fft/window.h>
+#include <volk/volk.h>
 #include "fft.h"
 #include "messageQueue.h"
+#include "accumulator.h"
 
 class SampleBuffer;
 class SignalSource;
+class Correlator;
+class Channelizer;
+class FrequencyTable;
 
+// With taps > 1 the window is a taps * numSamples long polyphase (WOLA)
+// window, and apply() folds the windowed samples into the first numSamples.
 class FFTWindow {
   std::vector<float> m_windowVector;
   float * m_window;
   uint32_t m_numSamples;
+  uint32_t m_taps;
  public:
   gr::fft::window::win_type m_type;
-  FFTWindow(gr::fft::window::win_type type, uint32_t numSamples);
+  FFTWindow(gr::fft::window::win_type type, uint32_t numSamples, uint32_t taps = 1);
   ~FFTWindow();
   void apply(fftwf_complex * samples);
+  // Sum of the window, the gain applied to a tone centered on a bin.
+  double GetCoherentGain();
+  // Sum of the squared window.
+  double GetEnergy();
 };
 
 
+// Header of a passband correction file, followed by one float per FFT bin,
+// lowest frequency first.
+struct PassbandHeader
+{
+  uint32_t m_sampleRate;
+  uint32_t m_fftSize;
+  // The LO sits m_tuneOffset Hz below the step frequency, which moves the
+  // filter shape across the bins.
+  double m_tuneOffset;
+  double m_useBandWidth;
+};
+
+// Summary of the bins of one block above the threshold.
+struct Detection
+{
+  double m_frequency;
+  double m_bandWidth;
+  double m_peakFrequency;
+  float m_peakPower;
+  uint32_t m_binCount;
+  // Zoom FFT refinement of the peak, zero resolution when not computed.
+  double m_zoomFrequency;
+  double m_zoomResolution;
+  float m_zoomPower;
+};
+
 class ProcessSamples {
 
  public:
   enum Mode {
     Illegal,
     TimeDomain,
-    FrequencyDomain
+    FrequencyDomain,
+    Correlation
   };
     
  private:
-  bool process_fft(fftwf_complex * fft_data, SampleQueue::MessageHeader * header);
+  // Inclusive range of signed FFT bins, negative frequencies below zero.
+  typedef std::pair<int32_t, int32_t> BinRange;
+  // Inclusive range of signed FFT bins checked against one threshold.
+  struct BinSpan
+  {
+    int32_t m_firstBin;
+    int32_t m_lastBin;
+    float m_powerThreshold;
+  };
+  // Processing descriptor of one frequency table step, hung off the table
+  // entry and found through the step index of each message.
+  struct StepDescriptor
+  {
+    // Frequency of bin -fftSize/2, and the bin width.
+    double m_startFrequency;
+    double m_binWidth;
+    uint32_t m_fftSize;
+    // Blocks with less energy than this can not reach the lowest threshold
+    // of the step.
+    float m_energyThreshold;
+    // The coarse threshold for the lowest threshold of the step, relative to
+    // the one for the global threshold.
+    float m_coarseThresholdScale;
+    // Passband correction of each bin of the step's FFT, lowest frequency
+    // first, or nullptr without a passband.
+    const float * m_passband;
+    // The used bins less the excluded ones, their per-bin thresholds run
+    // length encoded as spans.
+    std::vector<BinSpan> m_spans;
+  };
+  // A threshold for the bins between two frequencies, infinite to exclude
+  // them.
+  struct BandThreshold
+  {
+    double m_startFrequency;
+    double m_stopFrequency;
+    float m_powerThreshold;
+  };
+  std::vector<BinSpan> GetUsedSpans(uint32_t fftSize);
+  void UpdateUsedSpans();
+  uint32_t GetStepFFTSize(uint32_t step);
+  uint32_t GetSpectrumBinCount(uint32_t fftSize);
+  void BuildStepDescriptors();
+  bool process_fft(fftwf_complex * fft_data, 
+                   SampleQueue::MessageHeader * header,
+                   Detection & detection,
+                   const std::vector<BinRange> * ranges = nullptr);
+  bool DoCoarseDetection(fftwf_complex * inputSamples,
+                         uint32_t threadId,
+                         float thresholdScale,
+                         std::vector<BinRange> & ranges);
+  void Transform(uint32_t threadId, uint32_t sampleCount);
+  void ComputePowers(uint32_t threadId, uint32_t fftSize, const float * passband);
   void WriteToFile(const char * fileName, fftwf_complex * data);
   void WriteSamplesToFile(uint32_t count, double centerFrequency);
-  void WriteSamplesToFile(uint64_t sequenceId, double centerFrequency);
+  void WriteSamplesToFile(uint64_t sequenceId, 
+                          double centerFrequency,
+                          const Detection & detection,
+                          uint32_t stepIndex);
   void TimeToString(time_t time, char * buffer, uint32_t length);
   std::string GenerateFileName(std::string fileNameBase, 
                                time_t startTime, 
                                double_t centerFrequency);
-  bool DoTimeDomainThresholding(fftwf_complex * inputSamples, SampleQueue::MessageHeader * header);
+  bool DoTimeDomainThresholding(fftwf_complex * inputSamples, 
+                                SampleQueue::MessageHeader * header,
+                                uint32_t threadId);
+  bool DoCorrelation(fftwf_complex * inputSamples, 
+                     SampleQueue::MessageHeader * header,
+                     uint32_t threadId);
+  void DoZoom(fftwf_complex * inputSamples,
+              SampleQueue::MessageHeader * header,
+              uint32_t threadId,
+              Detection & detection);
+  bool DoChannelization(fftwf_complex * inputSamples, 
+                        SampleQueue::MessageHeader * header,
+                        uint32_t threadId);
   void UpdateEndSequenceId(uint64_t newEndSequenceId);
   void ProcessWrite(bool doWrite, 
                     double centerFrequency,
-                    uint64_t sequenceId);
+                    uint64_t sequenceId,
+                    const Detection & detection);
+  void ProcessStepWrite(bool doWrite, 
+                        double centerFrequency,
+                        uint32_t stepIndex,
+                        uint64_t sequenceId,
+                        const Detection & detection);
+  void FinishStepWrite(uint64_t sequenceId);
   void ThreadWorker(uint32_t threadId);
 
   static const uint32_t MAX_THREADS = 8;
   uint32_t m_sampleCount;
+  // FFT size, smaller than m_sampleCount with a polyphase window.
+  uint32_t m_fftSize;
   uint32_t m_sampleRate;
   uint32_t m_enob;
   uint32_t m_fileCounter;
   uint32_t m_preTrigger;
   uint32_t m_postTrigger;
   std::atomic<uint64_t> m_endSequenceId;
+  // In a sweep a trigger asks the source to hold its step for
+  // m_dwellCaptures captures, and the recording takes the blocks of that
+  // step only, m_postTrigger of them after the last trigger.
+  SignalSource * m_dwellSource;
+  uint32_t m_dwellCaptures;
+  std::mutex m_stepWriteMutex;
+  uint32_t m_writeStepIndex;
+  uint64_t m_writeTriggerSequenceId;
+  uint32_t m_postRemaining;
   bool m_correctDCOffset;
+  double m_useBandWidth;
   uint32_t m_useWindow;
   uint32_t m_dcIgnoreWindow;
+  double m_tuneOffset;
+  std::vector<BinSpan> m_usedSpans;
+  std::vector<BandThreshold> m_bandThresholds;
+  std::string m_spurFileName;
+  float m_spurMargin;
+  std::vector<StepDescriptor> m_stepDescriptors;
+  // FFT plans and windows of the frequency plan segments whose FFT size
+  // is not m_fftSize, keyed by size, with the passband at that size.
+  struct TransformPlan
+  {
+    FFT * m_fft;
+    FFTWindow * m_window;
+    std::vector<float> m_passband;
+  };
+  std::map<uint32_t, TransformPlan> m_transformPlans;
+  FrequencyTable * m_frequencyTable;
+  // Passband correction of the power of each bin, lowest frequency first.
+  std::vector<float> m_passband;
+  float m_passbandMaximum;
+  // Passband calibration, the summed power of each bin.
+  std::string m_calibrationFileName;
+  std::vector<double> m_calibrationSums;
+  uint64_t m_calibrationCount;
+  std::mutex m_calibrationMutex;
+  void Calibrate(uint32_t threadId);
+  void WriteCalibration();
+  lv_32fc_t m_tunePhaseIncrement;
   bool m_writeSamples;
+  bool m_writeNarrowband;
+  // The zoom FFT of m_sampleCount points and its window, and the per thread
+  // downconverters and buffers, are all set up before processing starts.
+  uint32_t m_zoomDecimation;
+  // Contiguous blocks the zoom needs, its FFT size after the filter
+  // transient at the decimated rate.
+  uint32_t m_zoomBlockCount;
+  FFT * m_zoomFFT;
+  FFTWindow * m_zoomWindow;
+  Downconverter * m_zoomDownconverters[MAX_THREADS];
+  fftwf_complex * m_zoomSamples[MAX_THREADS];
+  fftwf_complex * m_zoomBuffer[MAX_THREADS];
+  std::vector<lv_32fc_t> m_zoomOutput[MAX_THREADS];
+  // Sliding window time domain detector state, per frequency. The blocks of
+  // a frequency update it in sequence order.
+  struct TimeDomainState
+  {
+    std::mutex m_mutex;
+    std::condition_variable m_condition;
+    // Sequence id of the last block processed.
+    uint64_t m_lastSequenceId;
+    // Sample powers of the last window - 1 samples.
+    std::vector<float> m_tail;
+    bool m_inBurst;
+    uint64_t m_burstStart;
+    uint64_t m_burstEnd;
+    // Highest window mean power in the burst.
+    double m_burstPeak;
+
+    TimeDomainState()
+      : m_lastSequenceId(SampleQueue::s_noSequenceId),
+        m_inBurst(false)
+    {
+    }
+  };
+  void ReportBurst(double frequency, const TimeDomainState & state);
+  uint32_t m_timeDomainWindow;
+  std::map<double, TimeDomainState> m_timeDomainStates;
+  // Guards the lookup of a state only.
+  std::mutex m_timeDomainStatesMutex;
+  std::vector<float> m_timeDomainPowers[MAX_THREADS];
+  std::vector<float> m_timeDomainSums[MAX_THREADS];
+  std::vector<float> m_timeDomainPartials[MAX_THREADS][2];
   std::atomic<bool> m_writing;
   Mode m_mode;
   std::string m_fileNameBase;
   float m_threshold;
+  // The threshold as a squared FFT magnitude.
+  float m_powerThreshold;
+  // Blocks with less energy than this can not reach the threshold in any bin.
+  float m_energyThreshold;
+  std::atomic<uint64_t> m_processedBlocks;
+  std::atomic<uint64_t> m_skippedBlocks;
+  std::atomic<uint64_t> m_coarseSkippedBlocks;
   FFT m_fft;
+  // Computes only the used band when that is cheaper than m_fft.
+  PrunedFFT * m_prunedFFT;
+  fftwf_complex * m_prunedBuffer[MAX_THREADS];
+  // Spectrum accumulators, fed the linear power of the used band.
+  // Owned, deleted with this.
+  std::vector<SpectrumAccumulator *> m_accumulators;
+  // Set once the calibration and accumulators have been finished.
+  std::atomic<bool> m_finished;
+  std::vector<float> m_powers[MAX_THREADS];
+  // Coarse detection stage, gates the full resolution FFT.
+  FFT * m_coarseFFT;
+  FFTWindow * m_coarseWindow;
+  float m_coarsePowerThreshold;
+  fftwf_complex * m_coarseBuffer[MAX_THREADS];
   FFTWindow m_fftWindow;
   SampleQueue * m_sampleQueue;
   fftwf_complex * m_inputSamples[MAX_THREADS];
   fftwf_complex * m_fftOutputBuffer[MAX_THREADS];
+  fftwf_complex * m_correlationBuffer[MAX_THREADS];
+  Correlator * m_correlator;
+  fftwf_complex * m_channelizerBuffer[MAX_THREADS];
+  Channelizer * m_channelizer;
+  float m_channelThreshold;
+  FILE * m_channelFile;
+  std::mutex m_channelFileMutex;
   uint32_t m_threadCount;
   std::thread * m_threads[MAX_THREADS];
 
@@ -82,13 +309,35 @@ class ProcessSamples {
                  double useBandWidth = 0.75,
                  double dcIgnoreWidth = 0.0,
                  uint32_t preTrigger = 2,
-                 uint32_t postTrigger = 4);
+                 uint32_t postTrigger = 4,
+                 uint32_t windowTaps = 1);
   ~ProcessSamples();
   void Run(int16_t sample_buffer[][2], uint32_t centerFrequency);
   void RecordSamples(SignalSource * signalSource,
                      uint64_t count,
                      double threshold);
+  void SetCorrelator(Correlator * correlator);
+  void SetChannelizer(Channelizer * channelizer, float threshold);
+  void SetWriteNarrowband(bool writeNarrowband);
+  void SetZoomDecimation(uint32_t decimation);
+  void SetCoarseDetection(uint32_t coarseSize, float margin);
+  void SetTimeDomainWindow(uint32_t window);
+  void SetTuneOffset(double offset);
+  void SetTriggerDwell(SignalSource * signalSource, uint32_t captureCount);
+  void SetCalibration(std::string fileName);
+  void SetPassband(std::string fileName);
+  void SetFrequencyTable(FrequencyTable * frequencyTable);
+  void SetSpurs(std::string fileName, float margin);
+  void AddBandThreshold(double startFrequency, double stopFrequency, float threshold);
+  void AddExclusion(double startFrequency, double stopFrequency);
+  void AddAccumulator(SpectrumAccumulator * accumulator);
+  std::vector<SpectrumAccumulator::StepSpectrum> GetStepSpectra();
+  float GetPowerThreshold();
   bool StartProcessing(SampleQueue & sampleQueue);
+  void ReportStatistics();
+  // Writes the calibration and what the accumulators hold at the end, once,
+  // whether processing ran out of samples or was interrupted.
+  void Finish();
   bool m_writeData;
 };
 
@@ -0,0 +1,158 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <algorithm>
+#include <cassert>
+#include "retuneCost.h"
+
+RetuneCostModel::RetuneCostModel()
+{
+  for (auto & direction : this->m_buckets) {
+    for (auto & bucket : direction) {
+      bucket = Bucket{0.0, 0};
+    }
+  }
+}
+
+uint32_t RetuneCostModel::GetBucket(double jump)
+{
+  if (jump < 1e6) {
+    return 0;
+  }
+  return std::min<uint32_t>(1 + uint32_t(log2(jump / 1e6)), s_bucketCount - 1);
+}
+
+// The file has a line per measured bucket: direction, bucket, total
+// seconds and count.
+//
+bool RetuneCostModel::Read(std::string fileName)
+{
+  FILE * inFile = fopen(fileName.c_str(), "r");
+  if (inFile == nullptr) {
+    return false;
+  }
+  uint32_t direction, bucket;
+  double sum;
+  uint64_t count;
+  while (fscanf(inFile, "%u %u %lf %lu", &direction, &bucket, &sum, &count) == 4) {
+    if (direction > 1 || bucket >= s_bucketCount) {
+      fprintf(stderr, "Bad retune cost file '%s'\n", fileName.c_str());
+      exit(1);
+    }
+    this->m_buckets[direction][bucket] = Bucket{sum, count};
+  }
+  fclose(inFile);
+  return true;
+}
+
+void RetuneCostModel::Write(std::string fileName)
+{
+  FILE * outFile = fopen(fileName.c_str(), "w");
+  if (outFile == nullptr) {
+    fprintf(stderr, "Failed to open file '%s'\n", fileName.c_str());
+    return;
+  }
+  for (uint32_t direction = 0; direction < 2; direction++) {
+    for (uint32_t bucket = 0; bucket < s_bucketCount; bucket++) {
+      const Bucket & entry = this->m_buckets[direction][bucket];
+      if (entry.m_count > 0) {
+        fprintf(outFile, "%u %u %.9f %lu\n", direction, bucket, entry.m_sum, entry.m_count);
+      }
+    }
+  }
+  fclose(outFile);
+}
+
+void RetuneCostModel::AddMeasurement(double fromFrequency, double toFrequency, double seconds)
+{
+  Bucket & bucket = 
+    this->m_buckets[toFrequency < fromFrequency][GetBucket(fabs(toFrequency - fromFrequency))];
+  bucket.m_sum += seconds;
+  bucket.m_count++;
+}
+
+// Unmeasured jumps cost as much as the nearest measured bucket, preferring
+// the same direction. Without any measurements the cost is the jump size,
+// which keeps the ordering sensible.
+//
+double RetuneCostModel::GetCost(double fromFrequency, double toFrequency)
+{
+  uint32_t bucket = GetBucket(fabs(toFrequency - fromFrequency));
+  bool down = toFrequency < fromFrequency;
+  for (uint32_t distance = 0; distance < s_bucketCount; distance++) {
+    for (uint32_t direction : {uint32_t(down), uint32_t(!down)}) {
+      for (int32_t candidate : {int32_t(bucket - distance), int32_t(bucket + distance)}) {
+        if (candidate >= 0 && candidate < int32_t(s_bucketCount)) {
+          const Bucket & entry = this->m_buckets[direction][candidate];
+          if (entry.m_count > 0) {
+            return entry.m_sum / entry.m_count;
+          }
+        }
+      }
+    }
+  }
+  return fabs(toFrequency - fromFrequency) * 1e-12;
+}
+
+// Total cost of one sweep in order, including the jump back to the start.
+//
+double RetuneCostModel::GetSweepCost(const std::vector<double> & frequencies, 
+                                     const std::vector<uint32_t> & order)
+{
+  double cost = 0.0;
+  for (uint32_t i = 0; i < order.size(); i++) {
+    cost += this->GetCost(frequencies[order[i]], frequencies[order[(i + 1) % order.size()]]);
+  }
+  return cost;
+}
+
+// Order the steps to minimize the sweep cost, starting from table order and
+// improving it with 2-opt moves until none helps. Reversing a stretch of
+// the sweep turns its jumps around, which costs differently up and down, so
+// the prefix sums of the forward and backward jump costs give each move's
+// change in O(1). Every step is still visited once per sweep and step 0
+// stays first.
+//
+std::vector<uint32_t> RetuneCostModel::OptimizeOrder(const std::vector<double> & frequencies)
+{
+  uint32_t count = frequencies.size();
+  std::vector<uint32_t> order(count);
+  for (uint32_t i = 0; i < count; i++) {
+    order[i] = i;
+  }
+  if (count < 4) {
+    return order;
+  }
+  auto cost = [&](uint32_t a, uint32_t b) {
+    return this->GetCost(frequencies[order[a]], frequencies[order[b % count]]);
+  };
+  // forward[k] sums the jumps between positions 0..k, backward[k] the same
+  // jumps taken in reverse.
+  std::vector<double> forward(count);
+  std::vector<double> backward(count);
+  auto updateSums = [&]() {
+    forward[0] = backward[0] = 0.0;
+    for (uint32_t k = 1; k < count; k++) {
+      forward[k] = forward[k - 1] + cost(k - 1, k);
+      backward[k] = backward[k - 1] + cost(k, k - 1);
+    }
+  };
+  updateSums();
+  bool improved = true;
+  while (improved) {
+    improved = false;
+    for (uint32_t i = 0; i + 2 < count; i++) {
+      for (uint32_t j = i + 2; j < count; j++) {
+        // Reverse positions i + 1..j.
+        double before = cost(i, i + 1) + cost(j, j + 1) + forward[j] - forward[i + 1];
+        double after = cost(i, j) + cost(i + 1, j + 1) + backward[j] - backward[i + 1];
+        if (after < before * (1 - 1e-9)) {
+          std::reverse(order.begin() + i + 1, order.begin() + j + 1);
+          updateSums();
+          improved = true;
+        }
+      }
+    }
+  }
+  return order;
+}
@@ -0,0 +1,34 @@
+#pragma once
+
+#include <vector>
+#include <string>
+#include <cstdint>
+
+// Model of the time a tuner takes to retune, learned from measured
+// retunes. Measurements are averaged per jump direction and per jump size,
+// in power of 2 buckets from 1 MHz, which is what VCO and band switching
+// costs mostly depend on.
+//
+class RetuneCostModel
+{
+  static const uint32_t s_bucketCount = 16;
+  struct Bucket
+  {
+    double m_sum;
+    uint64_t m_count;
+  };
+  // Indexed by whether the jump is downwards, then by jump size.
+  Bucket m_buckets[2][s_bucketCount];
+  static uint32_t GetBucket(double jump);
+
+ public:
+  RetuneCostModel();
+  // Returns false when the file does not exist yet.
+  bool Read(std::string fileName);
+  void Write(std::string fileName);
+  void AddMeasurement(double fromFrequency, double toFrequency, double seconds);
+  double GetCost(double fromFrequency, double toFrequency);
+  double GetSweepCost(const std::vector<double> & frequencies, 
+                      const std::vector<uint32_t> & order);
+  std::vector<uint32_t> OptimizeOrder(const std::vector<double> & frequencies);
+};
@@ -36,8 +36,11 @@ RtlSource::RtlSource(std::string args,
                      uint32_t sampleRate, 
                      uint32_t sampleCount, 
                      double startFrequency, 
-                     double stopFrequency)
-  : SignalSource(sampleRate, sampleCount, startFrequency, stopFrequency),
+                     double stopFrequency,
+                     double useBandWidth,
+                     double tuneOffset,
+                     std::vector<FrequencyTable::Segment> segments)
+  : SignalSource(sampleRate, sampleCount, startFrequency, stopFrequency, useBandWidth, 0.0, tuneOffset, segments),
     m_dev(nullptr),
     m_streamingState(Illegal),
     m_bufferIndex(0),
@@ -146,6 +149,13 @@ double RtlSource::set_sample_rate( double rate )
   HANDLE_ERROR("Failed to set samplerate %d: %%d\n", uint32_t(rate) );
 }
 
+// The synchronous reader slept this long after a retune.
+//
+double RtlSource::GetMaxSettleTime()
+{
+  return this->m_retuneTime;
+}
+
 void RtlSource::_rtl_rx_callback(unsigned char *buf, uint32_t len, void *ctx)
 {
   RtlSource * obj = (RtlSource *)ctx;
@@ -161,18 +171,25 @@ int RtlSource::rtl_rx_callback(void * samples, int sample_count)
       this->m_dropPacketCount--;
       return 0;
     }
+    if (!this->IsSettled(reinterpret_cast<int8_t (*)[2]>(samples), uint32_t(sample_count))) {
+      return 0;
+    }
     double centerFrequency = this->GetCurrentFrequency();
+    uint32_t stepIndex = this->GetCurrentStepIndex();
     bool isScanStart = this->GetIsScanStart();
     startTime = time(NULL);
 
     double nextFrequency = this->GetNextFrequency();
-    if (this->GetFrequencyCount() > 1) {
-      this->Retune(nextFrequency);
-      this->m_dropPacketCount = this->m_dropPacketValue;
+    if (this->GetIsNewStep()) {
+      this->TimedRetune(nextFrequency);
+      if (this->m_settleDetector == nullptr) {
+        this->m_dropPacketCount = this->m_dropPacketValue;
+      }
     }
     for (uint32_t i = 0; i < sample_count/this->m_sampleCount; i++) {
       this->m_sampleQueue->AppendSamples(reinterpret_cast<int8_t (*)[2]>(samples) + i*sample_count,
                                          centerFrequency,
+                                         stepIndex,
                                          (isScanStart ? startTime : 0));
       isScanStart = false;
     }
@@ -191,46 +208,52 @@ bool RtlSource::StartStreaming(uint32_t numIterations, SampleQueue & sampleQueue
 
 void RtlSource::ThreadWorker()
 {
-  while (this->m_streamingState != Done) {
-    time_t startTime;
-    if (!this->GetIsDone()) { 
-      double centerFrequency = this->GetCurrentFrequency();
-      bool isScanStart = this->GetIsScanStart();
-      startTime = time(NULL);
-
-      // Read samples synchronously.
-      int n_read;
-      int status;
-      rtlsdr_reset_buffer(this->m_dev);
-      HANDLE_ERROR("Failed to reset buffer: %%d\n");
-      rtlsdr_read_sync(this->m_dev, 
-                       this->m_buffer,
-                       2 * this->m_sampleCount,
-                       &n_read);
-      HANDLE_ERROR("Failed to read samples: %%d\n");
-      assert(n_read == 2 * this->m_sampleCount);
-
-      double nextFrequency = this->GetNextFrequency();
-      if (this->GetFrequencyCount() > 1) {
-        this->Retune(nextFrequency);
-        std::this_thread::sleep_for(std::chrono::milliseconds(5));
-        this->m_dropPacketCount = this->m_dropPacketValue;
-      }
+  this->RunCaptureLoop();
+  this->m_streamingState = Done;
+}
 
-      this->m_sampleQueue->AppendSamples(this->m_buffer,
-                                         centerFrequency,
-                                         (isScanStart ? startTime : 0));
-      isScanStart = false;
-    } else {
-      this->m_streamingState = Done;
-    }
+bool RtlSource::CaptureSamples()
+{
+  // Read samples synchronously.
+  int n_read;
+  int status;
+  rtlsdr_reset_buffer(this->m_dev);
+  HANDLE_ERROR("Failed to reset buffer: %%d\n");
+  rtlsdr_read_sync(this->m_dev, 
+                   this->m_buffer,
+                   2 * this->m_sampleCount,
+                   &n_read);
+  HANDLE_ERROR("Failed to read samples: %%d\n");
+  assert(n_read == 2 * this->m_sampleCount);
+  return this->IsSettled(this->m_buffer, this->m_sampleCount);
+}
+
+void RtlSource::AppendCapture(double centerFrequency, uint32_t stepIndex, time_t time)
+{
+  this->m_sampleQueue->AppendSamples(this->m_buffer, centerFrequency, stepIndex, time);
+}
+
+void RtlSource::BeginRetune(double frequency)
+{
+  this->Retune(frequency);
+  this->m_settleDeadline = std::chrono::steady_clock::now() 
+    + std::chrono::microseconds(uint64_t(this->m_retuneTime * 1e6));
+}
+
+// Only the part of the settle time not spent appending the previous step
+// is slept.
+//
+void RtlSource::FinishRetune()
+{
+  if (this->m_settleDetector == nullptr) {
+    std::this_thread::sleep_until(this->m_settleDeadline);
   }
 }
 
 double RtlSource::Retune(double centerFrequency)
 {
   assert(this->m_dev != nullptr);
-  int status = rtlsdr_set_center_freq(this->m_dev, uint32_t(centerFrequency));
+  int status = rtlsdr_set_center_freq(this->m_dev, uint32_t(this->GetTunedFrequency(centerFrequency)));
   HANDLE_ERROR("Failed to tune to %d Hz: %%d\n", uint32_t(centerFrequency));
   return centerFrequency;
 }
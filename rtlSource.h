@@ -1,5 +1,6 @@
 #pragma once
 
+#include <chrono>
 #include <rtl-sdr.h>
 
 class RtlSource : public SignalSource
@@ -14,18 +15,28 @@ class RtlSource : public SignalSource
   uint32_t m_dropPacketCount;
   uint32_t m_dropPacketValue;
   int8_t (*m_buffer)[2];
+  // End of the fixed settle time after the last retune.
+  std::chrono::steady_clock::time_point m_settleDeadline;
   uint32_t m_bufferIndex;
   void handle_error(int status, const char * format, ...);
   static void _rtl_rx_callback(unsigned char *buf, uint32_t len, void *ctx);  
   int rtl_rx_callback(void *samples, int sample_count);
   double set_sample_rate( double rate );
+  virtual double GetMaxSettleTime();
+  virtual bool CaptureSamples();
+  virtual void AppendCapture(double centerFrequency, uint32_t stepIndex, time_t time);
+  virtual void BeginRetune(double frequency);
+  virtual void FinishRetune();
 
  public:
   RtlSource(std::string args,
                uint32_t sampleRate, 
                uint32_t sampleCount, 
                double startFrequency, 
-               double stopFrequency);
+               double stopFrequency,
+               double useBandWidth = 0.75,
+               double tuneOffset = 0.0,
+               std::vector<FrequencyTable::Segment> segments = std::vector<FrequencyTable::Segment>());
   virtual ~RtlSource();
   virtual bool GetNextSamples(SampleQueue * sampleQueue, double_t & centerFrequency);
   virtual bool StartStreaming(uint32_t numIterations, SampleQueue & sampleQueue);
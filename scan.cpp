@@ -12,6 +12,14 @@
 #include "messageQueue.h"
 #include "signalSource.h"
 #include "process.h"
+#include "correlator.h"
+#include "channelizer.h"
+#include "traceAccumulator.h"
+#include "occupancyAccumulator.h"
+#include "histogramAccumulator.h"
+#include "spurTable.h"
+#include "scheduler.h"
+#include "retuneCost.h"
 #include "bladerfSource.h"
 #ifdef INCLUDE_B210
 #include "b210Source.h"
@@ -20,6 +28,7 @@
 #include "sdrplaySource.h"
 #include "hackRFSource.h"
 #include "rtlSource.h"
+#include "mockSource.h"
 #include "scan.h"
 
 
@@ -29,6 +38,8 @@ struct Context
   ProcessSamples * m_process;
   SampleQueue * m_sampleQueue;
   struct timespec m_start, m_stop;
+  RetuneCostModel * m_retuneCost;
+  std::string m_retuneCostFileName;
 } globalContext;
 
 void TerminationHandler(int s)
@@ -45,7 +56,13 @@ void TerminationHandler(int s)
     double stopd = globalContext.m_stop.tv_sec*1000.0 + globalContext.m_stop.tv_nsec/1e6;
     double elapsed = stopd - startd;
     fprintf(stderr, "Elapsed time = %f ms\n", elapsed);
+    globalContext.m_process->ReportStatistics();
+    globalContext.m_process->Finish();
+    globalContext.m_signalSource->ReportSettleStatistics();
     fflush(stderr);
+    if (globalContext.m_retuneCost != nullptr) {
+      globalContext.m_retuneCost->Write(globalContext.m_retuneCostFileName);
+    }
 
     delete globalContext.m_signalSource;
   }
@@ -64,6 +81,20 @@ int main(int argc, char *argv[])
   double stopFrequency = 0; // This means don't sweep. Stay at startFrequency.
   double useBandWidth = 0.75;
   double dcIgnoreWidth = 0.0;
+  double tuneOffset = 0.0;
+  std::string calibrationFileName;
+  std::string passbandFileName;
+  std::string spurFileName;
+  std::string learnSpurFileName;
+  float spurMargin;
+  uint32_t adaptiveSweeps;
+  std::string retuneCostFileName;
+  uint32_t triggerDwell;
+  uint32_t lookahead;
+  std::vector<std::string> bandThresholds;
+  std::vector<std::string> exclusions;
+  std::string planFileName;
+  std::vector<std::string> segmentStrings;
   std::string args;
   std::string spec;
   std::string outFileName;
@@ -73,6 +104,22 @@ int main(int argc, char *argv[])
   uint32_t bandWidth;
   uint32_t preTrigger;
   uint32_t postTrigger;
+  std::vector<std::string> templateFileNames;
+  float correlationThreshold;
+  uint32_t channelCount;
+  uint32_t zoomDecimation;
+  uint32_t windowTaps;
+  uint32_t coarseSize;
+  uint32_t timeDomainWindow;
+  uint32_t traceCount;
+  float traceDecay;
+  uint32_t occupancyInterval;
+  uint32_t histogramInterval;
+  float histogramMinimum;
+  double occupancyWidth;
+  float coarseMargin;
+  std::vector<uint32_t> channels;
+  float channelThreshold;
   bool sweepMode = true;
 
   namespace po = boost::program_options;
@@ -80,18 +127,53 @@ int main(int argc, char *argv[])
   po::options_description desc("Program options");
   desc.add_options()
     ("help", "print help message")
+    ("adaptive", po::value<uint32_t>(&adaptiveSweeps)->default_value(0), "Visit active steps more often, revisiting every step within this many sweeps, 0 sweeps in table order")
     ("args", po::value<std::string>(&args)->default_value(""), "device args")
+    ("bandthreshold", po::value<std::vector<std::string>>(&bandThresholds)->composing(), "Threshold in dB for a band, as start:stop:threshold in Hz, may be repeated")
     ("bandwidth,b", po::value<uint32_t>(&bandWidth)->default_value(8000000), "Band width")
+    ("calibrate", po::value<std::string>(&calibrationFileName)->default_value(""), "Measure the passband shape from a flat input and write the correction to this file")
+    ("channels", po::value<uint32_t>(&channelCount)->default_value(0), "Number of polyphase filterbank channels, 0 disables the channelizer")
+    ("channel", po::value<std::vector<uint32_t>>(&channels)->composing(), "Channelizer channel to detect and record, may be repeated, default all")
+    ("chanthreshold", po::value<float>(&channelThreshold)->default_value(10.0), "Channel power threshold in dB")
+    ("coarse", po::value<uint32_t>(&coarseSize)->default_value(0), "FFT size of the coarse detection stage that gates the full FFT, 0 disables it")
+    ("coarsemargin", po::value<float>(&coarseMargin)->default_value(6.0), "How far below the threshold the coarse stage triggers, in dB")
+    ("corrthreshold", po::value<float>(&correlationThreshold)->default_value(0.6), "Normalized correlation threshold for template matching")
     ("count,c", po::value<uint32_t>(&sampleCount)->default_value(8192), "sample count")
+    ("ddc", "Record only the detected band, down converted and decimated")
     ("dcignorewidth,d", po::value<double>(&dcIgnoreWidth)->default_value(0.0), "ignore width window around DC")
-    ("mode,m", po::value<std::string>(&modeString)->default_value("time"), "processing mode 'time' or 'frequency'")
+    ("exclude", po::value<std::vector<std::string>>(&exclusions)->composing(), "Band to exclude from detection, as start:stop in Hz, may be repeated")
+    ("histogram", po::value<uint32_t>(&histogramInterval)->default_value(0), "Write power histogram snapshots every N seconds, 0 disables them")
+    ("histogrammin", po::value<float>(&histogramMinimum)->default_value(-20.0), "Power of the lowest 1 dB histogram bucket, 100 buckets")
+    ("learnspurs", po::value<std::string>(&learnSpurFileName)->default_value(""), "Learn the device spurs, with the antenna terminated, and write them to this file")
+    ("lookahead", po::value<uint32_t>(&lookahead)->default_value(0), "Blocks the source may capture ahead of the oldest unprocessed one before it stops retuning, 0 is unlimited")
+    ("mode,m", po::value<std::string>(&modeString)->default_value("time"), "processing mode 'time', 'frequency' or 'correlate'")
     ("niterations,n", po::value<uint32_t>(&num_iterations)->default_value(10), "Number of iterations")
+    ("oversample", "Use a 2x oversampled channelizer")
+    ("occupancy", po::value<uint32_t>(&occupancyInterval)->default_value(0), "Write occupancy snapshots every N seconds, 0 disables them")
+    ("occupancywidth", po::value<double>(&occupancyWidth)->default_value(25000), "Occupancy channel width in Hz")
     ("outfile,o", po::value<std::string>(&outFileName)->default_value(""), "File name base to record samples")
+    ("plan", po::value<std::string>(&planFileName)->default_value(""), "Frequency plan file of segments and exclusions, replaces the start and stop frequencies")
     ("pre", po::value<uint32_t>(&preTrigger)->default_value(2), "Pre-trigger buffer save count")
+    ("passband", po::value<std::string>(&passbandFileName)->default_value(""), "Passband correction file from a calibration run with this device and sample rate")
     ("post", po::value<uint32_t>(&postTrigger)->default_value(4), "Post-trigger buffer save count")
+    ("reorder", "Reorder the sweep to minimize the retune time predicted by the --retunecost model")
+    ("retunecost", po::value<std::string>(&retuneCostFileName)->default_value(""), "Retune time model of this device, learned from the sweep and updated in this file")
     ("samplerate,s", po::value<uint32_t>(&sample_rate)->default_value(8000000), "Sample rate")
+    ("segment", po::value<std::vector<std::string>>(&segmentStrings)->composing(), "Frequency plan segment, as start:stop[:usebandwidth[:dwell[:threshold[:count]]]], may be repeated")
+    ("settle", "Release the samples after a retune once they settle, instead of after a fixed time")
+    ("spurmargin", po::value<float>(&spurMargin)->default_value(6.0), "dB above a learned spur for its bin to trigger, or below the threshold for a bin to be learned")
+    ("spurs", po::value<std::string>(&spurFileName)->default_value(""), "Spur file from a --learnspurs run with this device and sample rate")
     ("spec", po::value<std::string>(&spec)->default_value(""), "Sub-device of UHD device")
-    ("threshold,t", po::value<float>(&threshold)->default_value(10.0), "Threshold");
+    ("taps", po::value<uint32_t>(&windowTaps)->default_value(1), "Polyphase (WOLA) window taps, folds each block of count samples into a count/taps point FFT")
+    ("template", po::value<std::vector<std::string>>(&templateFileNames)->composing(), "Complex template file to correlate against, may be repeated")
+    ("threshold,t", po::value<float>(&threshold)->default_value(10.0), "Threshold")
+    ("trace", po::value<uint32_t>(&traceCount)->default_value(0), "Write average, max and min traces per step every N spectra, 0 disables them")
+    ("tracedecay", po::value<float>(&traceDecay)->default_value(0.0), "Exponential decay of the average trace, 0 averages each frame")
+    ("triggerdwell", po::value<uint32_t>(&triggerDwell)->default_value(0), "In a sweep, hold at or return to a triggering step for this many captures and record its pre and post trigger blocks, 0 records nothing in a sweep")
+    ("tuneoffset", po::value<double>(&tuneOffset)->default_value(0.0), "Tune this many Hz below each step so the DC spike moves off the step frequency, and out of the used band when larger than half of it")
+    ("usebandwidth", po::value<double>(&useBandWidth)->default_value(0.75), "Fraction of the sample rate used per step")
+    ("window", po::value<uint32_t>(&timeDomainWindow)->default_value(64), "Time domain detector window length in samples")
+    ("zoom", po::value<uint32_t>(&zoomDecimation)->default_value(0), "Zoom FFT decimation used to refine detections, a power of 2");
 
   // Hidden options.
   po::options_description hidden("Hidden options");
@@ -120,12 +202,14 @@ int main(int argc, char *argv[])
     mode = ProcessSamples::TimeDomain;
   } else if (modeString.find("frequency") != std::string::npos) {
     mode = ProcessSamples::FrequencyDomain;
+  } else if (modeString.find("correlate") != std::string::npos) {
+    mode = ProcessSamples::Correlation;
   }
   if (vm.count("help") || mode == ProcessSamples::Illegal) {
     std::cout << desc << hidden << "\n";
     return 1;
   }
-  if (!vm.count("start_freq")) {
+  if (!vm.count("start_freq") && planFileName == "" && segmentStrings.empty()) {
     std::cout << "No start frequency" << "\n";
     std::cout << desc << hidden << "\n";
     return 1;
@@ -133,6 +217,201 @@ int main(int argc, char *argv[])
   if (!vm.count("stop_freq")) {
     stopFrequency = 0; // This means don't sweep. Stay at startFrequency.
   }
+  if (channelCount != 0 && (channelCount < 2 || channelCount % 2 != 0)) {
+    std::cout << "Channel count must be even" << "\n";
+    return 1;
+  }
+  if (windowTaps == 0 || sampleCount % windowTaps != 0) {
+    std::cout << "Sample count must be a multiple of the window taps" << "\n";
+    return 1;
+  }
+  if (windowTaps > 1 && mode != ProcessSamples::FrequencyDomain) {
+    std::cout << "Window taps require frequency mode" << "\n";
+    return 1;
+  }
+  if (coarseSize != 0 
+      && (mode != ProcessSamples::FrequencyDomain 
+          || coarseSize < 2 
+          || (sampleCount / windowTaps) % coarseSize != 0)) {
+    std::cout << "Coarse size must divide the FFT size and requires frequency mode" << "\n";
+    return 1;
+  }
+  if (timeDomainWindow == 0 || timeDomainWindow > sampleCount) {
+    std::cout << "Window must be between 1 and the sample count" << "\n";
+    return 1;
+  }
+  if (traceCount != 0 && (mode != ProcessSamples::FrequencyDomain || outFileName == "")) {
+    std::cout << "Traces require frequency mode and an output file name base" << "\n";
+    return 1;
+  }
+  if (occupancyInterval != 0 && (mode != ProcessSamples::FrequencyDomain || outFileName == "")) {
+    std::cout << "Occupancy requires frequency mode and an output file name base" << "\n";
+    return 1;
+  }
+  if (histogramInterval != 0 && (mode != ProcessSamples::FrequencyDomain || outFileName == "")) {
+    std::cout << "Histograms require frequency mode and an output file name base" << "\n";
+    return 1;
+  }
+  if (traceDecay < 0.0 || traceDecay >= 1.0) {
+    std::cout << "Trace decay must be in [0, 1)" << "\n";
+    return 1;
+  }
+  if ((calibrationFileName != "" || passbandFileName != "") 
+      && mode != ProcessSamples::FrequencyDomain) {
+    std::cout << "Passband calibration requires frequency mode" << "\n";
+    return 1;
+  }
+  if ((spurFileName != "" || learnSpurFileName != "") 
+      && mode != ProcessSamples::FrequencyDomain) {
+    std::cout << "Spur tables require frequency mode" << "\n";
+    return 1;
+  }
+  if (adaptiveSweeps != 0 
+      && (mode != ProcessSamples::FrequencyDomain || args.find("hackrf") != std::string::npos)) {
+    std::cout << "Adaptive sweeps require frequency mode and are not supported by the hackrf sweep" << "\n";
+    return 1;
+  }
+  if (vm.count("reorder") && (retuneCostFileName == "" || adaptiveSweeps != 0)) {
+    std::cout << "Reordering requires a retune cost model and can not be combined with adaptive sweeps" << "\n";
+    return 1;
+  }
+  if (retuneCostFileName != "" && args.find("hackrf") != std::string::npos) {
+    std::cout << "The hackrf sweep retunes in the device and can not be measured" << "\n";
+    return 1;
+  }
+  if (triggerDwell != 0 && (outFileName == "" || args.find("hackrf") != std::string::npos)) {
+    std::cout << "Trigger dwell requires an output file name base and is not supported by the hackrf sweep" << "\n";
+    return 1;
+  }
+  if (lookahead != 0 && args.find("hackrf") != std::string::npos) {
+    std::cout << "The hackrf sweep retunes in the device and can not be held back" << "\n";
+    return 1;
+  }
+  if (vm.count("settle") && args.find("hackrf") != std::string::npos) {
+    std::cout << "The hackrf sweep drops the settling samples in the device" << "\n";
+    return 1;
+  }
+  if (tuneOffset > useBandWidth * sample_rate / 2 && args.find("hackrf") != std::string::npos) {
+    std::cout << "The hackrf sweep tunes above the start of each step, "
+              << "so the tune offset can not exceed half the use band width" << "\n";
+    return 1;
+  }
+  if ((!bandThresholds.empty() || !exclusions.empty()) 
+      && mode != ProcessSamples::FrequencyDomain) {
+    std::cout << "Band thresholds and exclusions require frequency mode" << "\n";
+    return 1;
+  }
+  for (auto & band : bandThresholds) {
+    double start, stop;
+    float bandThreshold;
+    if (sscanf(band.c_str(), "%lf:%lf:%f", &start, &stop, &bandThreshold) != 3 || start > stop) {
+      std::cout << "Bad band threshold '" << band << "'" << "\n";
+      return 1;
+    }
+  }
+  for (auto & band : exclusions) {
+    double start, stop;
+    if (sscanf(band.c_str(), "%lf:%lf", &start, &stop) != 2 || start > stop) {
+      std::cout << "Bad exclusion '" << band << "'" << "\n";
+      return 1;
+    }
+  }
+  std::vector<FrequencyTable::Segment> segments;
+  if (planFileName != "") {
+    segments = FrequencyTable::ReadPlan(planFileName, useBandWidth, threshold);
+  }
+  for (auto & text : segmentStrings) {
+    FrequencyTable::Segment segment{0.0, 0.0, useBandWidth, 1, threshold, 0, {}};
+    int count = sscanf(text.c_str(), 
+                       "%lf:%lf:%lf:%u:%f:%u", 
+                       &segment.m_startFrequency,
+                       &segment.m_stopFrequency,
+                       &segment.m_useBandWidth,
+                       &segment.m_dwell,
+                       &segment.m_threshold,
+                       &segment.m_sampleCount);
+    if (count < 2 
+        || segment.m_startFrequency >= segment.m_stopFrequency
+        || segment.m_useBandWidth <= 0.0 
+        || segment.m_useBandWidth > 1.0
+        || segment.m_dwell == 0) {
+      std::cout << "Bad segment '" << text << "'" << "\n";
+      return 1;
+    }
+    segments.push_back(segment);
+  }
+  if (!segments.empty()) {
+    if (args.find("hackrf") != std::string::npos) {
+      std::cout << "Frequency plans are not supported by the hackrf sweep" << "\n";
+      return 1;
+    }
+    // The global exclusions drop steps too, and processing is sized for the
+    // widest segment.
+    for (auto & band : exclusions) {
+      double start, stop;
+      sscanf(band.c_str(), "%lf:%lf", &start, &stop);
+      for (auto & segment : segments) {
+        segment.m_exclusions.push_back(std::make_pair(start, stop));
+      }
+    }
+    useBandWidth = 0.0;
+    bool resized = false;
+    for (auto & segment : segments) {
+      useBandWidth = std::max(useBandWidth, segment.m_useBandWidth);
+      // Blocks are captured at the full sample count and split into the
+      // segment's FFT size.
+      uint32_t size = segment.m_sampleCount;
+      if (size != 0 && (size < 16 || (size & (size - 1)) || sampleCount % size != 0)) {
+        std::cout << "Segment FFT sizes must be powers of 2 that divide the sample count" << "\n";
+        return 1;
+      }
+      resized |= size != 0 && size != sampleCount;
+    }
+    // Passbands, spurs and accumulators follow the FFT size of each step.
+    // The rest work on blocks of the full sample count: the step
+    // descriptors exist in frequency mode only, the polyphase window folds
+    // taps blocks into one, the coarse stage and the zoom cut up or join
+    // full blocks, the channelizer is built for the full block, and a
+    // calibration measures the passband at the full FFT size.
+    if (resized 
+        && (mode != ProcessSamples::FrequencyDomain 
+            || windowTaps != 1 
+            || coarseSize != 0 
+            || zoomDecimation > 1 
+            || channelCount != 0 
+            || calibrationFileName != "")) {
+      std::cout << "Segment FFT sizes require frequency mode and are not supported "
+                << "with taps, coarse detection, zoom, channels or calibration" << "\n";
+      return 1;
+    }
+  }
+  if (tuneOffset != 0.0) {
+    // A whole number of cycles per block keeps the shifted blocks continuous.
+    // Captures are split into the segment FFT sizes, so the offset has to
+    // fit the smallest of them.
+    uint32_t blockSize = sampleCount;
+    for (auto & segment : segments) {
+      if (segment.m_sampleCount != 0) {
+        blockSize = std::min(blockSize, segment.m_sampleCount);
+      }
+    }
+    double blockBinWidth = double(sample_rate) / blockSize;
+    tuneOffset = round(tuneOffset / blockBinWidth) * blockBinWidth;
+    // The used band is clipped on each side of the step frequency, at the
+    // DC spike and at the edge of the sampled band, which move with the LO.
+    if (fabs(tuneOffset) >= sample_rate / 2) {
+      std::cout << "Tune offset must be below half the sample rate" << "\n";
+      return 1;
+    }
+  }
+  if (zoomDecimation & (zoomDecimation - 1)) {
+    std::cout << "Zoom decimation must be a power of 2" << "\n";
+    return 1;
+  }
+  if (mode == ProcessSamples::Correlation && templateFileNames.empty()) {
+    std::cout << "Correlate mode requires at least one template" << "\n";
+    return 1;
+  }
 
   SignalSource * source = nullptr;
   uint32_t enob = 12;
@@ -145,7 +424,9 @@ int main(int argc, char *argv[])
                                startFrequency, 
                                stopFrequency,
                                useBandWidth,
-                               dcIgnoreWidth);
+                               dcIgnoreWidth,
+                               tuneOffset,
+                               segments);
     correctDCOffset = true;
 #ifdef INCLUDE_B210
   } else if (args.find("b200") != std::string::npos) {
@@ -154,7 +435,10 @@ int main(int argc, char *argv[])
       sample_rate, 
       sampleCount, 
       startFrequency, 
-      stopFrequency);
+      stopFrequency,
+      useBandWidth,
+      tuneOffset,
+      segments);
     sampleKind = SampleQueue::FloatComplex;
 #endif
   } else if (args.find("airspy") != std::string::npos) {
@@ -162,7 +446,10 @@ int main(int argc, char *argv[])
       sample_rate, 
       sampleCount, 
       startFrequency, 
-      stopFrequency);
+      stopFrequency,
+      useBandWidth,
+      tuneOffset,
+      segments);
     sampleKind = SampleQueue::FloatComplex;
     correctDCOffset = false;
   } else if (args.find("sdrplay") != std::string::npos) {
@@ -171,7 +458,10 @@ int main(int argc, char *argv[])
       sampleCount, 
       startFrequency, 
       stopFrequency,
-      bandWidth);
+      bandWidth,
+      useBandWidth,
+      tuneOffset,
+      segments);
     correctDCOffset = false;
     sampleKind = SampleQueue::Short;
   } else if (args.find("hackrf") != std::string::npos) {
@@ -179,7 +469,10 @@ int main(int argc, char *argv[])
       sample_rate, 
       sampleCount, 
       startFrequency, 
-      stopFrequency);
+      stopFrequency,
+      useBandWidth,
+      tuneOffset,
+      segments);
     enob = 8;
     correctDCOffset = true;
     sampleKind = SampleQueue::ByteComplex;
@@ -192,20 +485,64 @@ int main(int argc, char *argv[])
       sample_rate, 
       sampleCount, 
       startFrequency, 
-      stopFrequency);
+      stopFrequency,
+      useBandWidth,
+      tuneOffset,
+      segments);
     enob = 8;
     correctDCOffset = false;
     sampleKind = SampleQueue::ByteComplex;
     dcIgnoreWidth = 0.0;
+  } else if (args.find("mock") != std::string::npos) {
+    source = new MockSource(args, 
+      sample_rate, 
+      sampleCount, 
+      startFrequency, 
+      stopFrequency,
+      useBandWidth,
+      tuneOffset,
+      segments);
+    sampleKind = SampleQueue::FloatComplex;
   } else {
     std::cout << "Missing source type argument" << std::endl;
     std::cout << desc << "\n";
     return 1;
   }
 
+  if (vm.count("settle")) {
+    source->SetSettleDetection(sampleKind == SampleQueue::FloatComplex ? 1.0 : ldexp(1.0, enob - 1));
+  }
   if (source->GetFrequencyCount() > 1) {
-    preTrigger = 0;
-    postTrigger = 0;
+    if (triggerDwell == 0) {
+      preTrigger = 0;
+      postTrigger = 0;
+    }
+    if (adaptiveSweeps != 0) {
+      uint32_t stepCount = source->GetFrequencyCount();
+      source->GetFrequencyTable()->SetScheduler(new SweepScheduler(stepCount, 
+                                                                   adaptiveSweeps * stepCount));
+    }
+  }
+  RetuneCostModel * retuneCost = nullptr;
+  if (retuneCostFileName != "") {
+    retuneCost = new RetuneCostModel();
+    bool learned = retuneCost->Read(retuneCostFileName);
+    source->SetRetuneCostModel(retuneCost);
+    if (vm.count("reorder") && learned && source->GetFrequencyCount() > 1) {
+      FrequencyTable * frequencyTable = source->GetFrequencyTable();
+      std::vector<double> frequencies(frequencyTable->GetFrequencyCount());
+      std::vector<uint32_t> order(frequencies.size());
+      for (uint32_t step = 0; step < frequencies.size(); step++) {
+        frequencies[step] = frequencyTable->GetFrequencyFromIndex(step);
+        order[step] = step;
+      }
+      double tableCost = retuneCost->GetSweepCost(frequencies, order);
+      order = retuneCost->OptimizeOrder(frequencies);
+      printf("Reordered sweep, predicted retune time %.3f ms instead of %.3f ms\n",
+             1e3 * retuneCost->GetSweepCost(frequencies, order),
+             1e3 * tableCost);
+      frequencyTable->SetOrder(order);
+    }
   }
 
   ProcessSamples process(sampleCount, 
@@ -219,11 +556,102 @@ int main(int argc, char *argv[])
                          useBandWidth,
                          dcIgnoreWidth,
                          preTrigger,
-                         postTrigger);
+                         postTrigger,
+                         windowTaps);
+  Correlator * correlator = nullptr;
+  if (mode == ProcessSamples::Correlation) {
+    correlator = new Correlator(templateFileNames, correlationThreshold, sampleCount);
+    process.SetCorrelator(correlator);
+  }
+  process.SetWriteNarrowband(vm.count("ddc") > 0);
+  process.SetZoomDecimation(zoomDecimation);
+  process.SetTimeDomainWindow(timeDomainWindow);
+  if (triggerDwell != 0 && source->GetFrequencyCount() > 1) {
+    process.SetTriggerDwell(source, triggerDwell);
+  }
+  if (tuneOffset != 0.0) {
+    process.SetTuneOffset(tuneOffset);
+  }
+  if (calibrationFileName != "") {
+    process.SetCalibration(calibrationFileName);
+  }
+  if (passbandFileName != "") {
+    process.SetPassband(passbandFileName);
+  }
+  if (mode == ProcessSamples::FrequencyDomain) {
+    process.SetFrequencyTable(source->GetFrequencyTable());
+  }
+  if (spurFileName != "") {
+    process.SetSpurs(spurFileName, spurMargin);
+  }
+  for (auto & band : bandThresholds) {
+    double start, stop;
+    float bandThreshold;
+    sscanf(band.c_str(), "%lf:%lf:%f", &start, &stop, &bandThreshold);
+    process.AddBandThreshold(start, stop, bandThreshold);
+  }
+  for (auto & band : exclusions) {
+    double start, stop;
+    sscanf(band.c_str(), "%lf:%lf", &start, &stop);
+    process.AddExclusion(start, stop);
+  }
+  if (learnSpurFileName != "") {
+    process.AddAccumulator(new SpurLearner(source->GetFrequencyTable(),
+                                           process.GetStepSpectra(),
+                                           learnSpurFileName,
+                                           sample_rate,
+                                           sampleCount / windowTaps,
+                                           threshold,
+                                           spurMargin));
+  }
+  if (traceCount != 0) {
+    process.AddAccumulator(new TraceAccumulator(source->GetFrequencyTable(),
+                                                process.GetStepSpectra(),
+                                                outFileName + "trace",
+                                                traceCount,
+                                                traceDecay));
+  }
+  if (occupancyInterval != 0) {
+    process.AddAccumulator(new OccupancyAccumulator(source->GetFrequencyTable(),
+                                                    process.GetStepSpectra(),
+                                                    outFileName + "occupancy",
+                                                    process.GetPowerThreshold(),
+                                                    occupancyWidth,
+                                                    occupancyInterval));
+  }
+  if (histogramInterval != 0) {
+    process.AddAccumulator(new HistogramAccumulator(source->GetFrequencyTable(),
+                                                    process.GetStepSpectra(),
+                                                    outFileName + "histogram",
+                                                    100,
+                                                    histogramMinimum,
+                                                    1.0,
+                                                    histogramInterval));
+  }
+  if (coarseSize != 0) {
+    process.SetCoarseDetection(coarseSize, coarseMargin);
+  }
+  Channelizer * channelizer = nullptr;
+  if (channelCount > 0) {
+    channelizer = new Channelizer(channelCount, vm.count("oversample") > 0, channels);
+    process.SetChannelizer(channelizer, channelThreshold);
+  }
   SampleQueue sampleQueue(sampleKind, enob, sampleCount, 1024, correctDCOffset, outFileName != "");
+  if (!segments.empty()) {
+    FrequencyTable * frequencyTable = source->GetFrequencyTable();
+    std::vector<uint32_t> stepSampleCounts(frequencyTable->GetFrequencyCount());
+    for (uint32_t step = 0; step < stepSampleCounts.size(); step++) {
+      uint32_t size = frequencyTable->GetSegmentFromIndex(step).m_sampleCount;
+      stepSampleCounts[step] = size != 0 ? size : sampleCount;
+    }
+    sampleQueue.SetStepSampleCounts(stepSampleCounts);
+  }
+  sampleQueue.SetCreditWindow(lookahead);
 
   // Save context and setup termination handler.
   globalContext = Context{source, &process, &sampleQueue};
+  globalContext.m_retuneCost = retuneCost;
+  globalContext.m_retuneCostFileName = retuneCostFileName;
 
   struct sigaction sigIntHandler;
   sigIntHandler.sa_handler = TerminationHandler;
@@ -236,6 +664,9 @@ int main(int argc, char *argv[])
   clock_gettime(CLOCK_REALTIME, &globalContext.m_start);
   source->StartStreaming(num_iterations, sampleQueue);
   process.StartProcessing(sampleQueue);
+  // The process threads have stopped.
+  delete correlator;
+  delete channelizer;
   TerminationHandler(0);
   return 0;
 }
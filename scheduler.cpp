@@ -0,0 +1,53 @@
+#include <algorithm>
+#include <cassert>
+#include "scheduler.h"
+
+// The first sweep visits the steps in table order.
+//
+SweepScheduler::SweepScheduler(uint32_t stepCount, uint32_t maxInterval, float decay)
+  : m_softDeadline(stepCount),
+    m_hardDeadline(stepCount),
+    m_activity(stepCount, 0.0),
+    m_detections(stepCount),
+    m_maxInterval(maxInterval),
+    m_decay(decay),
+    m_time(0)
+{
+  assert(stepCount > 0 && maxInterval >= stepCount);
+  for (uint32_t step = 0; step < stepCount; step++) {
+    this->m_detections[step] = 0;
+    this->m_softDeadline[step] = step;
+    this->m_hardDeadline[step] = step;
+    this->m_softDeadlines.insert(Deadline(step, step));
+    this->m_hardDeadlines.insert(Deadline(step, step));
+  }
+}
+
+// Visit the next step and reschedule it. Its activity decays by m_decay
+// per visit and gains the detections since the last one, and its soft
+// interval is maxInterval / (1 + activity).
+//
+uint32_t SweepScheduler::GetNextStep()
+{
+  uint32_t step = this->m_softDeadlines.begin()->second;
+  if (this->m_hardDeadlines.begin()->first <= this->m_time) {
+    step = this->m_hardDeadlines.begin()->second;
+  }
+  this->m_softDeadlines.erase(Deadline(this->m_softDeadline[step], step));
+  this->m_hardDeadlines.erase(Deadline(this->m_hardDeadline[step], step));
+  float & activity = this->m_activity[step];
+  activity = this->m_decay * activity + this->m_detections[step].exchange(0);
+  uint64_t interval = std::max<uint64_t>(1, this->m_maxInterval / (1.0 + activity));
+  this->m_softDeadline[step] = this->m_time + interval;
+  this->m_hardDeadline[step] = this->m_time + this->m_maxInterval;
+  this->m_softDeadlines.insert(Deadline(this->m_softDeadline[step], step));
+  this->m_hardDeadlines.insert(Deadline(this->m_hardDeadline[step], step));
+  this->m_time++;
+  return step;
+}
+
+void SweepScheduler::ReportActivity(uint32_t step)
+{
+  assert(step < this->m_detections.size());
+  this->m_detections[step]++;
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <set>
+#include <vector>
+#include <atomic>
+#include <cstdint>
+
+// Activity driven order of the steps of a frequency table. Time counts
+// visits. Each step has a hard deadline, its last visit plus maxInterval,
+// and a soft deadline that comes sooner the more activity the step has
+// shown recently. A step whose hard deadline is due goes first, earliest
+// first, otherwise the earliest soft deadline does, so busy steps are
+// revisited more often and quiet ones within maxInterval visits, late by
+// at most the number of steps due at the same time. Both deadline orders
+// are kept in sets, so choosing the next step is O(log n).
+//
+class SweepScheduler
+{
+  // A deadline and its step.
+  typedef std::pair<uint64_t, uint32_t> Deadline;
+  std::set<Deadline> m_softDeadlines;
+  std::set<Deadline> m_hardDeadlines;
+  std::vector<uint64_t> m_softDeadline;
+  std::vector<uint64_t> m_hardDeadline;
+  std::vector<float> m_activity;
+  // Detections reported by the processing threads since the last visit.
+  std::vector<std::atomic<uint32_t>> m_detections;
+  uint32_t m_maxInterval;
+  float m_decay;
+  uint64_t m_time;
+
+ public:
+  SweepScheduler(uint32_t stepCount, uint32_t maxInterval, float decay = 0.5);
+  uint32_t GetNextStep();
+  // Thread safe.
+  void ReportActivity(uint32_t step);
+};
@@ -51,8 +51,20 @@ SdrplaySource::SdrplaySource(std::string args,
                              uint32_t sampleCount, 
                              double startFrequency, 
                              double stopFrequency,
-                             uint32_t bandWidth)
-  : SignalSource(sampleRate, sampleCount, startFrequency, stopFrequency, 0.75, 0.05),
+                             uint32_t bandWidth,
+                             double useBandWidth,
+                             double tuneOffset,
+                             std::vector<FrequencyTable::Segment> segments)
+  // With offset tuning the DC spike is outside the used band and the steps
+  // need not leave room for it.
+  : SignalSource(sampleRate, 
+                 sampleCount, 
+                 startFrequency, 
+                 stopFrequency, 
+                 useBandWidth, 
+                 tuneOffset != 0.0 ? 0.0 : 0.05,
+                 tuneOffset,
+                 segments),
     m_samplesPerPacket(0),
     m_firstSampleNum(0),
     m_sample_buffer_i(nullptr),
@@ -93,7 +105,7 @@ SdrplaySource::SdrplaySource(std::string args,
   // Initialise API and hardware  
   status = mir_sdr_Init(gRdB, 
                         double(sampleRate/1e6),
-                        centerFrequency/1e6,
+                        this->GetTunedFrequency(centerFrequency)/1e6,
                         bw,
                         mir_sdr_IF_Zero,
                         &this->m_samplesPerPacket);
@@ -127,6 +139,7 @@ bool SdrplaySource::GetNextSamples(SampleQueue *  sampleQueue, double & centerFr
   mir_sdr_ErrT status;
 
   centerFrequency = this->GetCurrentFrequency();
+  uint32_t stepIndex = this->GetCurrentStepIndex();
 
   /* ... Handle signals at current frequency ... */
   for (uint32_t count = 0; 
@@ -146,12 +159,13 @@ bool SdrplaySource::GetNextSamples(SampleQueue *  sampleQueue, double & centerFr
                  count);
   }
   double nextFrequency = this->GetNextFrequency();
-  if (this->GetFrequencyCount() > 1) {
-    this->Retune(nextFrequency);
+  if (this->GetIsNewStep()) {
+    this->TimedRetune(nextFrequency);
   }
   this->m_sampleQueue->AppendSamples(this->m_sample_buffer_i, 
                                       this->m_sample_buffer_q,
                                      centerFrequency,
+                                     stepIndex,
                                      0);
   return true;
 }
@@ -164,42 +178,41 @@ bool SdrplaySource::StartStreaming(uint32_t numIterations, SampleQueue & sampleQ
 
 void SdrplaySource::ThreadWorker()
 {
-  mir_sdr_ErrT status;
+  this->RunCaptureLoop();
+}
 
-  while (!this->GetIsDone()) { 
-    /* ... Handle signals at current frequency ... */
-    double centerFrequency = this->GetCurrentFrequency();
-    uint32_t count;
-    time_t startTime;
-    startTime = time(NULL);
-    bool isScanStart = this->GetIsScanStart();
-    for (count = 0; 
-         count < this->m_sampleCount; 
-         count += this->m_samplesPerPacket) {
-      int grChanged = 0;
-      int rfChanged = 0;
-      int fsChanged = 0;
-      status =  mir_sdr_ReadPacket(&this->m_sample_buffer_i[count],
-                                   &this->m_sample_buffer_q[count],
-                                   &this->m_firstSampleNum,
-                                   &grChanged,
-                                   &rfChanged,
-                                   &fsChanged);
-      HANDLE_ERROR("Error receiving samples at %.0f[%u] : %%s\n", 
-                   centerFrequency,
-                   count);
-    }
-    //printf("count[%u] samplesPerPacket[%u]\n", count, this->m_samplesPerPacket);
-    double nextFrequency = this->GetNextFrequency();
-    if (this->GetFrequencyCount() > 1) {
-      this->Retune(nextFrequency);
-    }
-    this->m_sampleQueue->AppendSamples(this->m_sample_buffer_i, 
-                                       this->m_sample_buffer_q,
-                                       centerFrequency,
-                                       (isScanStart ? startTime : 0));
+bool SdrplaySource::CaptureSamples()
+{
+  mir_sdr_ErrT status;
+  double centerFrequency = this->GetCurrentFrequency();
+  uint32_t count;
+  for (count = 0; 
+       count < this->m_sampleCount; 
+       count += this->m_samplesPerPacket) {
+    int grChanged = 0;
+    int rfChanged = 0;
+    int fsChanged = 0;
+    status =  mir_sdr_ReadPacket(&this->m_sample_buffer_i[count],
+                                 &this->m_sample_buffer_q[count],
+                                 &this->m_firstSampleNum,
+                                 &grChanged,
+                                 &rfChanged,
+                                 &fsChanged);
+    HANDLE_ERROR("Error receiving samples at %.0f[%u] : %%s\n", 
+                 centerFrequency,
+                 count);
   }
-  return;
+  //printf("count[%u] samplesPerPacket[%u]\n", count, this->m_samplesPerPacket);
+  return this->IsSettled(this->m_sample_buffer_i, this->m_sample_buffer_q, this->m_sampleCount);
+}
+
+void SdrplaySource::AppendCapture(double centerFrequency, uint32_t stepIndex, time_t time)
+{
+  this->m_sampleQueue->AppendSamples(this->m_sample_buffer_i, 
+                                     this->m_sample_buffer_q,
+                                     centerFrequency,
+                                     stepIndex,
+                                     time);
 }
 
 double SdrplaySource::Retune(double centerFrequency)
@@ -208,7 +221,7 @@ double SdrplaySource::Retune(double centerFrequency)
   printf("Tuning to %.0f Hz\n", centerFrequency);
   status = mir_sdr_ResetUpdateFlags(0, 1, 0);
   HANDLE_ERROR("Failed to reset rf update: %%s\n");
-  status = mir_sdr_SetRf(centerFrequency, 1, 0);
+  status = mir_sdr_SetRf(this->GetTunedFrequency(centerFrequency), 1, 0);
   HANDLE_ERROR("Failed to tune to %.0f Hz: %%s\n", 
                centerFrequency);
   return centerFrequency;
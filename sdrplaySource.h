@@ -16,6 +16,8 @@ class SdrplaySource : public SignalSource
   uint32_t m_bufferSize;
   const char * errorToString(mir_sdr_ErrT code);
   void handle_error(mir_sdr_ErrT status, const char * format, ...);
+  virtual bool CaptureSamples();
+  virtual void AppendCapture(double centerFrequency, uint32_t stepIndex, time_t time);
 
  public:
   SdrplaySource(std::string args,
@@ -23,7 +25,10 @@ class SdrplaySource : public SignalSource
                 uint32_t sampleCount, 
                 double startFrequency, 
                 double stopFrequency,
-                uint32_t bandWidth);
+                uint32_t bandWidth,
+                double useBandWidth = 0.75,
+                double tuneOffset = 0.0,
+                std::vector<FrequencyTable::Segment> segments = std::vector<FrequencyTable::Segment>());
   virtual ~SdrplaySource();
   virtual bool GetNextSamples(SampleQueue * sampleQueue, double_t & centerFrequency);
   virtual bool StartStreaming(uint32_t numIterations, SampleQueue & sampleQueue);
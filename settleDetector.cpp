@@ -0,0 +1,142 @@
+#include <stdio.h>
+#include <math.h>
+#include <cassert>
+#include "settleDetector.h"
+
+// The halves of a settled block differ by estimation noise only, well
+// within these limits for the block sizes used.
+static const double s_maxPowerRatio = 1.26;       // 1 dB
+static const double s_maxDCChange = 0.01;         // -20 dB of the power
+static const double s_saturationFraction = 0.99;
+
+SettleDetector::SettleDetector(double sampleRate, double maxSettleTime, double fullScale)
+  : m_sampleRate(sampleRate),
+    m_maxSettleSamples(ceil(sampleRate * maxSettleTime)),
+    m_saturationLevel(s_saturationFraction * fullScale),
+    m_isSettling(false),
+    m_settleSamples(0),
+    m_lastSettleTime(0.0),
+    m_settleCount(0),
+    m_timeoutCount(0),
+    m_settleTimeSum(0.0),
+    m_settleTimeMaximum(0.0)
+{
+}
+
+void SettleDetector::Retuned()
+{
+  this->m_isSettling = true;
+  this->m_settleSamples = 0;
+}
+
+bool SettleDetector::GetIsSettling()
+{
+  return this->m_isSettling;
+}
+
+double SettleDetector::GetLastSettleTime()
+{
+  return this->m_lastSettleTime;
+}
+
+template <typename Sample>
+SettleDetector::HalfStatistics SettleDetector::GetStatistics(Sample sample,
+                                                             uint32_t start,
+                                                             uint32_t stop)
+{
+  HalfStatistics statistics = {0.0, std::complex<double>(0.0, 0.0), 0};
+  for (uint32_t i = start; i < stop; i++) {
+    std::complex<double> value = sample(i);
+    statistics.m_power += std::norm(value);
+    statistics.m_dc += value;
+    if (fabs(value.real()) >= this->m_saturationLevel
+        || fabs(value.imag()) >= this->m_saturationLevel) {
+      statistics.m_saturatedCount++;
+    }
+  }
+  uint32_t count = stop - start;
+  statistics.m_power /= count;
+  statistics.m_dc /= double(count);
+  return statistics;
+}
+
+template <typename Sample>
+bool SettleDetector::UpdateBlock(Sample sample, uint32_t count)
+{
+  if (!this->m_isSettling) {
+    return true;
+  }
+  assert(count >= 2);
+  bool isSettled = false;
+  bool isTimeout = false;
+  if (this->m_settleSamples >= this->m_maxSettleSamples) {
+    isTimeout = true;
+  } else {
+    HalfStatistics first = this->GetStatistics(sample, 0, count / 2);
+    HalfStatistics second = this->GetStatistics(sample, count / 2, count);
+    double meanPower = (first.m_power + second.m_power) / 2;
+    isSettled = first.m_saturatedCount == 0
+      && second.m_saturatedCount == 0
+      && first.m_power <= s_maxPowerRatio * second.m_power
+      && second.m_power <= s_maxPowerRatio * first.m_power
+      && std::norm(first.m_dc - second.m_dc) <= s_maxDCChange * meanPower;
+  }
+  if (!isSettled && !isTimeout) {
+    this->m_settleSamples += count;
+    return false;
+  }
+  this->m_isSettling = false;
+  this->m_lastSettleTime = this->m_settleSamples / this->m_sampleRate;
+  this->m_settleCount++;
+  this->m_settleTimeSum += this->m_lastSettleTime;
+  if (this->m_lastSettleTime > this->m_settleTimeMaximum) {
+    this->m_settleTimeMaximum = this->m_lastSettleTime;
+  }
+  if (isTimeout) {
+    this->m_timeoutCount++;
+  }
+  return true;
+}
+
+bool SettleDetector::Update(int8_t (*samples)[2], uint32_t count)
+{
+  return this->UpdateBlock([samples](uint32_t i) {
+      return std::complex<double>(samples[i][0], samples[i][1]);
+    }, count);
+}
+
+bool SettleDetector::Update(int16_t (*samples)[2], uint32_t count)
+{
+  return this->UpdateBlock([samples](uint32_t i) {
+      return std::complex<double>(samples[i][0], samples[i][1]);
+    }, count);
+}
+
+bool SettleDetector::Update(const int16_t * realSamples,
+                            const int16_t * imagSamples,
+                            uint32_t count)
+{
+  return this->UpdateBlock([realSamples, imagSamples](uint32_t i) {
+      return std::complex<double>(realSamples[i], imagSamples[i]);
+    }, count);
+}
+
+bool SettleDetector::Update(const fftwf_complex * samples, uint32_t count)
+{
+  return this->UpdateBlock([samples](uint32_t i) {
+      return std::complex<double>(samples[i][0], samples[i][1]);
+    }, count);
+}
+
+void SettleDetector::ReportStatistics()
+{
+  if (this->m_settleCount == 0) {
+    return;
+  }
+  fprintf(stderr, "Settle time: %lu retunes, mean %.3f ms, maximum %.3f ms, %lu at the %.3f ms limit\n",
+          this->m_settleCount,
+          1e3 * this->m_settleTimeSum / this->m_settleCount,
+          1e3 * this->m_settleTimeMaximum,
+          this->m_timeoutCount,
+          1e3 * this->m_maxSettleSamples / this->m_sampleRate);
+}
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <cstdint>
+#include <complex>
+#include "fft.h"
+
+// Decides when the samples after a retune have settled. The power, DC
+// offset and saturated sample count of the two halves of each block are
+// compared; a block whose halves agree, and that does not saturate, is
+// taken to be past the tuner transient and is released. Blocks are dropped
+// until then, or until the device's maximum settle time has passed.
+//
+class SettleDetector
+{
+  struct HalfStatistics
+  {
+    double m_power;
+    std::complex<double> m_dc;
+    uint32_t m_saturatedCount;
+  };
+  double m_sampleRate;
+  uint64_t m_maxSettleSamples;
+  // Sample magnitude at which a component counts as saturated.
+  double m_saturationLevel;
+  bool m_isSettling;
+  uint64_t m_settleSamples;
+  double m_lastSettleTime;
+  // Settle latencies observed since the start.
+  uint64_t m_settleCount;
+  uint64_t m_timeoutCount;
+  double m_settleTimeSum;
+  double m_settleTimeMaximum;
+  template <typename Sample>
+  HalfStatistics GetStatistics(Sample sample, uint32_t start, uint32_t stop);
+  template <typename Sample>
+  bool UpdateBlock(Sample sample, uint32_t count);
+
+ public:
+  SettleDetector(double sampleRate, double maxSettleTime, double fullScale);
+  void Retuned();
+  bool GetIsSettling();
+  // Return true when the block is settled and should be released.
+  bool Update(int8_t (*samples)[2], uint32_t count);
+  bool Update(int16_t (*samples)[2], uint32_t count);
+  bool Update(const int16_t * realSamples, const int16_t * imagSamples, uint32_t count);
+  bool Update(const fftwf_complex * samples, uint32_t count);
+  // Time from the retune to the first released sample of the last settle.
+  double GetLastSettleTime();
+  void ReportStatistics();
+};
@@ -1,9 +1,11 @@
 #include <math.h>
 #include <time.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include "fft.h"
 #include "messageQueue.h"
 #include "signalSource.h"
+#include "retuneCost.h"
 
 SignalSource::SignalSource(uint32_t sampleRate,
                            uint32_t sampleCount,
@@ -11,6 +13,8 @@ SignalSource::SignalSource(uint32_t sampleRate,
                            double stopFrequency,
                            double useBandWidth,
                            double dcIgnoreWidth,
+                           double tuneOffset,
+                           std::vector<FrequencyTable::Segment> segments,
                            bool doTiming) 
   : m_sampleRate(sampleRate),
     m_sampleCount(sampleCount),
@@ -19,8 +23,20 @@ SignalSource::SignalSource(uint32_t sampleRate,
     m_iterationLimit(0),
     m_thread(nullptr),
     m_finished(false),
-    m_synchronousMode(false),
-    m_frequencyTable(sampleRate, startFrequency, stopFrequency, useBandWidth, dcIgnoreWidth),
+    m_frequencyTable(sampleRate, 
+                     startFrequency, 
+                     stopFrequency, 
+                     useBandWidth, 
+                     dcIgnoreWidth, 
+                     segments),
+    m_tuneOffset(tuneOffset),
+    m_retuneCost(nullptr),
+    m_retuneFrequency(0.0),
+    m_retuneTarget(0.0),
+    m_retuneSeconds(0.0),
+    m_settleDetector(nullptr),
+    m_settleFromFrequency(0.0),
+    m_settleRetuneTime(0.0),
     m_doTiming(doTiming),
     m_retuneTimeIndex(0),
     m_getSamplesTimeIndex(0),
@@ -31,6 +47,7 @@ SignalSource::SignalSource(uint32_t sampleRate,
 
 SignalSource::~SignalSource() 
 {
+  delete this->m_settleDetector;
 } 
 
 bool SignalSource::Start() {}
@@ -39,14 +56,47 @@ bool SignalSource::Stop() {}
 
 double SignalSource::GetNextFrequency(void ** pinfo)
 {
+  DwellCommand command;
+  while (this->m_dwellCommands.Pop(command)) {
+    this->m_frequencyTable.HoldStep(command.m_stepIndex, command.m_captureCount);
+  }
   return this->m_frequencyTable.GetNextFrequency(pinfo);
 }
 
+// Hold at, or return to, a step for captureCount captures, then resume the
+// sweep. Safe to call from any thread; returns false when the request is
+// dropped because the channel is full.
+//
+bool SignalSource::RequestDwell(uint32_t stepIndex, uint32_t captureCount)
+{
+  return this->m_dwellCommands.Push(DwellCommand{stepIndex, captureCount});
+}
+
+bool SignalSource::GetIsNewStep()
+{
+  return this->m_frequencyTable.GetIsNewStep();
+}
+
 double SignalSource::GetCurrentFrequency(void ** pinfo)
 {
   return this->m_frequencyTable.GetCurrentFrequency(pinfo);
 }
 
+double SignalSource::GetTunedFrequency(double frequency)
+{
+  return frequency - this->m_tuneOffset;
+}
+
+uint32_t SignalSource::GetStepIndex(double frequency)
+{
+  return this->m_frequencyTable.GetIndexFromFrequency(frequency);
+}
+
+uint32_t SignalSource::GetCurrentStepIndex()
+{
+  return this->m_frequencyTable.GetCurrentIndex();
+}
+
 double SignalSource::GetStartFrequency()
 {
   return this->m_frequencyTable.GetStartFrequency();
@@ -62,6 +112,149 @@ uint32_t SignalSource::GetFrequencyCount()
   return this->m_frequencyTable.GetFrequencyCount();
 }
 
+FrequencyTable * SignalSource::GetFrequencyTable()
+{
+  return &this->m_frequencyTable;
+}
+
+void SignalSource::SetRetuneCostModel(RetuneCostModel * retuneCost)
+{
+  this->m_retuneCost = retuneCost;
+}
+
+void SignalSource::SetSettleDetection(double fullScale)
+{
+  delete this->m_settleDetector;
+  this->m_settleDetector = new SettleDetector(this->m_sampleRate, 
+                                              this->GetMaxSettleTime(), 
+                                              fullScale);
+}
+
+// The default for devices without a known settle time.
+//
+double SignalSource::GetMaxSettleTime()
+{
+  return 0.010;
+}
+
+void SignalSource::ReportSettleStatistics()
+{
+  if (this->m_settleDetector != nullptr) {
+    this->m_settleDetector->ReportStatistics();
+  }
+}
+
+static double GetElapsedSeconds(const struct timespec & start)
+{
+  struct timespec stop;
+  clock_gettime(CLOCK_MONOTONIC, &stop);
+  return (stop.tv_sec - start.tv_sec) + (stop.tv_nsec - start.tv_nsec) / 1e9;
+}
+
+// Retune to the next step of the sweep, adding the time the jump took to
+// the retune cost model. With settle detection the measurement waits for
+// the settle time, which is part of the cost of the jump.
+//
+double SignalSource::TimedRetune(double frequency)
+{
+  this->StartRetune(frequency);
+  this->CompleteRetune();
+  return frequency;
+}
+
+void SignalSource::StartRetune(double frequency)
+{
+  if (this->m_settleDetector != nullptr) {
+    this->m_settleDetector->Retuned();
+  }
+  struct timespec start;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  this->BeginRetune(frequency);
+  this->m_retuneSeconds = GetElapsedSeconds(start);
+  this->m_retuneTarget = frequency;
+}
+
+// Only the time spent in the two halves counts as retune time, not the
+// work done between them.
+//
+void SignalSource::CompleteRetune()
+{
+  struct timespec start;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  this->FinishRetune();
+  double seconds = this->m_retuneSeconds + GetElapsedSeconds(start);
+  if (this->m_retuneCost != nullptr && this->m_retuneFrequency != 0.0) {
+    if (this->m_settleDetector != nullptr) {
+      this->m_settleFromFrequency = this->m_retuneFrequency;
+      this->m_settleRetuneTime = seconds;
+    } else {
+      this->m_retuneCost->AddMeasurement(this->m_retuneFrequency, this->m_retuneTarget, seconds);
+    }
+  }
+  this->m_retuneFrequency = this->m_retuneTarget;
+}
+
+void SignalSource::BeginRetune(double frequency)
+{
+  this->Retune(frequency);
+}
+
+void SignalSource::FinishRetune()
+{
+}
+
+bool SignalSource::CaptureSamples()
+{
+  fprintf(stderr, "The source does not support the capture loop\n");
+  exit(1);
+}
+
+void SignalSource::AppendCapture(double centerFrequency, uint32_t stepIndex, time_t time)
+{
+  fprintf(stderr, "The source does not support the capture loop\n");
+  exit(1);
+}
+
+void SignalSource::RunCaptureLoop()
+{
+  bool isRetuning = false;
+  while (!this->GetIsDone()) {
+    if (isRetuning) {
+      this->CompleteRetune();
+      isRetuning = false;
+    }
+    double centerFrequency = this->GetCurrentFrequency();
+    uint32_t stepIndex = this->GetCurrentStepIndex();
+    time_t startTime = time(NULL);
+    if (!this->CaptureSamples()) {
+      continue;
+    }
+    bool isScanStart = this->GetIsScanStart();
+    if (this->DoRetune()) {
+      double nextFrequency = this->GetNextFrequency();
+      if (this->GetIsNewStep()) {
+        this->StartRetune(nextFrequency);
+        isRetuning = true;
+      }
+    }
+    this->AppendCapture(centerFrequency, stepIndex, (isScanStart ? startTime : 0));
+  }
+  if (isRetuning) {
+    this->CompleteRetune();
+  }
+}
+
+void SignalSource::AddSettledRetune()
+{
+  if (this->m_retuneCost != nullptr && this->m_settleFromFrequency != 0.0) {
+    this->m_retuneCost->AddMeasurement(this->m_settleFromFrequency,
+                                       this->m_retuneFrequency,
+                                       this->m_settleRetuneTime 
+                                       + this->m_settleDetector->GetLastSettleTime());
+    this->m_settleFromFrequency = 0.0;
+  }
+}
+
 bool SignalSource::GetIsScanStart()
 {
   return this->m_frequencyTable.GetIsScanStart();
@@ -72,10 +265,13 @@ uint32_t SignalSource::GetIterationCount()
   return this->m_frequencyTable.GetIterationCount();
 }
 
+// Whether the sample queue's credit window lets the source move on to the
+// next step. Without credit it captures the current step again.
+//
 bool SignalSource::DoRetune()
 {
-  if (this->m_synchronousMode && this->m_sampleQueue != nullptr) {
-    return this->m_sampleQueue->ReceivedAck();
+  if (this->m_sampleQueue != nullptr) {
+    return this->m_sampleQueue->HasCredit();
   }
   return true;
 }
@@ -4,7 +4,12 @@
 #include <cstdint>
 #include <memory>
 #include <thread>
+#include <time.h>
 #include "frequencyTable.h"
+#include "settleDetector.h"
+#include "commandChannel.h"
+
+class RetuneCostModel;
 
 class SignalSource
 {
@@ -16,7 +21,6 @@ class SignalSource
   uint32_t m_getSamplesTimeIndex;
   bool m_isDone; // Set to true to terminate
   bool m_finished;
-  bool m_synchronousMode;
   std::unique_ptr<std::thread> m_thread;
   std::vector<double> m_retuneTime;
   std::vector<double> m_getSamplesTime;
@@ -28,6 +32,67 @@ class SignalSource
   double m_startFrequency;
   double m_stopFrequency;
   FrequencyTable m_frequencyTable;
+  // The hardware is tuned this far below each step frequency, so the DC
+  // spike falls outside the used band. Processing shifts it back.
+  double m_tuneOffset;
+  double GetTunedFrequency(double frequency);
+  // Step of a frequency reported by the device, a search of the table.
+  uint32_t GetStepIndex(double frequency);
+  // Step of GetCurrentFrequency.
+  uint32_t GetCurrentStepIndex();
+  // Measures the retunes of the sweep when set.
+  RetuneCostModel * m_retuneCost;
+  double m_retuneFrequency;
+  double TimedRetune(double frequency);
+  // A retune split in two, so work can be done while the tuner settles.
+  void StartRetune(double frequency);
+  void CompleteRetune();
+  double m_retuneTarget;
+  double m_retuneSeconds;
+  // Pipelined capture loop of the synchronous sources: after capturing
+  // step N it starts the retune to step N + 1 and hands step N's samples to
+  // the queue while the tuner settles. The retune is only waited for before
+  // the capture of step N + 1.
+  void RunCaptureLoop();
+  // Hooks of the capture loop, overridden by the sources that run it.
+  // CaptureSamples reads a block at the current step and returns false when
+  // it has to be dropped. BeginRetune issues the retune and FinishRetune
+  // waits until the tuner can be captured from.
+  virtual bool CaptureSamples();
+  virtual void AppendCapture(double centerFrequency, uint32_t stepIndex, time_t time);
+  virtual void BeginRetune(double frequency);
+  virtual void FinishRetune();
+  // Drops the samples after a retune until they settle when set.
+  SettleDetector * m_settleDetector;
+  // Source frequency and duration of a measured retune waiting for its
+  // settle time.
+  double m_settleFromFrequency;
+  double m_settleRetuneTime;
+  void AddSettledRetune();
+  // Returns false while the samples after a retune are still settling, and
+  // the block should be dropped.
+  template <typename... Samples>
+  bool IsSettled(Samples... samples)
+  {
+    if (this->m_settleDetector == nullptr || !this->m_settleDetector->GetIsSettling()) {
+      return true;
+    }
+    if (!this->m_settleDetector->Update(samples...)) {
+      return false;
+    }
+    this->AddSettledRetune();
+    return true;
+  }
+  // Upper bound of the settle time after a retune.
+  virtual double GetMaxSettleTime();
+  // Requests from the processing threads to hold a step, applied by the
+  // source thread at its next step.
+  struct DwellCommand
+  {
+    uint32_t m_stepIndex;
+    uint32_t m_captureCount;
+  };
+  CommandChannel<DwellCommand, 64> m_dwellCommands;
   uint32_t m_iterationLimit;
   SampleQueue * m_sampleQueue;
   void SetIsDone();
@@ -37,6 +102,7 @@ class SignalSource
   uint32_t GetIterationCount();
   double GetCurrentFrequency(void ** pinfo = nullptr);
   double GetNextFrequency(void ** pinfo = nullptr);
+  bool GetIsNewStep();
   double GetStartFrequency();
   double GetStopFrequency();
   bool GetIsDone();
@@ -48,6 +114,8 @@ class SignalSource
                double m_stopFrequency,
                double useBandWidth = 0.75,
                double dcIgnoreWidth = 0.0,
+               double tuneOffset = 0.0,
+               std::vector<FrequencyTable::Segment> segments = std::vector<FrequencyTable::Segment>(),
                bool doTiming = false);
   virtual ~SignalSource();
   virtual bool Start();
@@ -58,6 +126,12 @@ class SignalSource
   virtual double Retune(double frequency) = 0;
   bool DoRetune();
   uint32_t GetFrequencyCount();
+  FrequencyTable * GetFrequencyTable();
+  void SetRetuneCostModel(RetuneCostModel * retuneCost);
+  // fullScale is the sample magnitude at which the device saturates.
+  void SetSettleDetection(double fullScale);
+  void ReportSettleStatistics();
+  bool RequestDwell(uint32_t stepIndex, uint32_t captureCount);
   bool GetIsScanStart();
   void StopStreaming();
   void StartTimer();
@@ -0,0 +1,90 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <math.h>
+#include "spurTable.h"
+
+SpurLearner::SpurLearner(FrequencyTable * frequencyTable,
+                         const std::vector<StepSpectrum> & stepSpectra,
+                         std::string fileName,
+                         uint32_t sampleRate,
+                         uint32_t fftSize,
+                         float threshold,
+                         float margin)
+  : SpectrumAccumulator(frequencyTable, stepSpectra, fileName),
+    m_sampleRate(sampleRate),
+    m_fftSize(fftSize),
+    m_threshold(threshold),
+    m_margin(margin)
+{
+  this->m_sums.resize(this->m_stepCount);
+  for (uint32_t step = 0; step < this->m_stepCount; step++) {
+    this->m_sums[step].assign(stepSpectra[step].m_binCount, 0.0);
+  }
+  this->m_counts.assign(this->m_stepCount, 0);
+}
+
+void SpurLearner::DoUpdate(uint32_t step, uint64_t, const float * powers)
+{
+  std::vector<double> & sums = this->m_sums[step];
+  for (uint32_t i = 0; i < sums.size(); i++) {
+    sums[i] += powers[i];
+  }
+  this->m_counts[step]++;
+}
+
+void SpurLearner::Finish()
+{
+  std::unique_lock<std::mutex> locker(this->m_mutex);
+  uint32_t spurCount = 0;
+  fprintf(this->m_file, "%u %u\n", this->m_sampleRate, this->m_fftSize);
+  for (uint32_t step = 0; step < this->m_stepCount; step++) {
+    if (this->m_counts[step] == 0) {
+      continue;
+    }
+    int32_t halfBinCount = this->m_stepSpectra[step].m_binCount / 2;
+    for (uint32_t i = 0; i < this->m_stepSpectra[step].m_binCount; i++) {
+      double power = this->m_sums[step][i] / this->m_counts[step];
+      float level = 5 * log10(power);
+      if (level > this->m_threshold - this->m_margin) {
+        fprintf(this->m_file, 
+                "%u %.0f %d %f\n", 
+                step, 
+                this->m_frequencyTable->GetFrequencyFromIndex(step),
+                int32_t(i) - halfBinCount,
+                level);
+        spurCount++;
+      }
+    }
+  }
+  fflush(this->m_file);
+  printf("Learned %u spurs\n", spurCount);
+}
+
+std::vector<Spur> SpurLearner::Read(std::string fileName, uint32_t sampleRate, uint32_t fftSize)
+{
+  FILE * inFile = fopen(fileName.c_str(), "r");
+  if (inFile == nullptr) {
+    fprintf(stderr, "Failed to open file '%s'\n", fileName.c_str());
+    exit(1);
+  }
+  uint32_t fileSampleRate;
+  uint32_t fileFftSize;
+  if (fscanf(inFile, "%u %u", &fileSampleRate, &fileFftSize) != 2
+      || fileSampleRate != sampleRate
+      || fileFftSize != fftSize) {
+    fprintf(stderr, 
+            "Spur file '%s' does not match sample rate %u and FFT size %u\n", 
+            fileName.c_str(),
+            sampleRate,
+            fftSize);
+    exit(1);
+  }
+  std::vector<Spur> spurs;
+  Spur spur;
+  double frequency;
+  while (fscanf(inFile, "%u %lf %d %f", &spur.m_step, &frequency, &spur.m_bin, &spur.m_level) == 4) {
+    spurs.push_back(spur);
+  }
+  fclose(inFile);
+  return spurs;
+}
@@ -0,0 +1,42 @@
+#pragma once
+
+#include "accumulator.h"
+
+// A fixed internal spur of the device, at a signed FFT bin of a step, in
+// the FFT size of the step.
+struct Spur
+{
+  uint32_t m_step;
+  int32_t m_bin;
+  // Mean level in the 10 * log10 magnitude units of the threshold.
+  float m_level;
+};
+
+// Learns the spurs of a device from a run with the antenna terminated: the
+// bins whose mean power over the run comes within margin dB of the
+// threshold. When processing finishes the spurs are written to a text
+// file, one "step frequency bin level" line per spur after a header line
+// with the sample rate and FFT size.
+//
+class SpurLearner : public SpectrumAccumulator
+{
+  std::vector<std::vector<double>> m_sums;
+  std::vector<uint32_t> m_counts;
+  uint32_t m_sampleRate;
+  uint32_t m_fftSize;
+  float m_threshold;
+  float m_margin;
+
+  void DoUpdate(uint32_t step, uint64_t sequenceId, const float * powers);
+
+ public:
+  SpurLearner(FrequencyTable * frequencyTable,
+              const std::vector<StepSpectrum> & stepSpectra,
+              std::string fileName,
+              uint32_t sampleRate,
+              uint32_t fftSize,
+              float threshold,
+              float margin);
+  void Finish();
+  static std::vector<Spur> Read(std::string fileName, uint32_t sampleRate, uint32_t fftSize);
+};
@@ -0,0 +1,70 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <cassert>
+#include <volk/volk.h>
+#include "traceAccumulator.h"
+
+TraceAccumulator::TraceAccumulator(FrequencyTable * frequencyTable,
+                                   const std::vector<StepSpectrum> & stepSpectra,
+                                   std::string fileName,
+                                   uint32_t frameCount,
+                                   float decay)
+  : SpectrumAccumulator(frequencyTable, stepSpectra, fileName),
+    m_frameCount(frameCount),
+    m_decay(decay)
+{
+  assert(frameCount > 0 && decay >= 0.0 && decay < 1.0);
+  this->m_traces.resize(this->m_stepCount);
+  for (uint32_t step = 0; step < this->m_stepCount; step++) {
+    Trace & trace = this->m_traces[step];
+    uint32_t binCount = stepSpectra[step].m_binCount;
+    trace.m_average.assign(binCount, 0.0);
+    trace.m_max.assign(binCount, 0.0);
+    trace.m_min.assign(binCount, 0.0);
+    trace.m_count = 0;
+    trace.m_decayStarted = false;
+  }
+  this->m_frame.resize(3 * this->m_binCount);
+  this->m_scratch.resize(this->m_binCount);
+}
+
+void TraceAccumulator::DoUpdate(uint32_t step, uint64_t sequenceId, const float * powers)
+{
+  Trace & trace = this->m_traces[step];
+  uint32_t binCount = this->m_stepSpectra[step].m_binCount;
+  if (trace.m_count == 0) {
+    memcpy(&trace.m_max[0], powers, sizeof(float) * binCount);
+    memcpy(&trace.m_min[0], powers, sizeof(float) * binCount);
+  } else {
+    volk_32f_x2_max_32f(&trace.m_max[0], &trace.m_max[0], powers, binCount);
+    volk_32f_x2_min_32f(&trace.m_min[0], &trace.m_min[0], powers, binCount);
+  }
+  if (this->m_decay == 0.0) {
+    // Sum here, scaled to the average when the frame is written.
+    volk_32f_x2_add_32f(&trace.m_average[0], &trace.m_average[0], powers, binCount);
+  } else if (!trace.m_decayStarted) {
+    memcpy(&trace.m_average[0], powers, sizeof(float) * binCount);
+    trace.m_decayStarted = true;
+  } else {
+    // average = decay * average + (1 - decay) * powers
+    volk_32f_s32f_multiply_32f(&trace.m_average[0], &trace.m_average[0], this->m_decay, binCount);
+    volk_32f_s32f_multiply_32f(&this->m_scratch[0], powers, 1.0 - this->m_decay, binCount);
+    volk_32f_x2_add_32f(&trace.m_average[0], &trace.m_average[0], &this->m_scratch[0], binCount);
+  }
+  if (++trace.m_count < this->m_frameCount) {
+    return;
+  }
+
+  float * frame = &this->m_frame[0];
+  if (this->m_decay == 0.0) {
+    volk_32f_s32f_multiply_32f(frame, &trace.m_average[0], 1.0 / trace.m_count, binCount);
+    trace.m_average.assign(binCount, 0.0);
+  } else {
+    memcpy(frame, &trace.m_average[0], sizeof(float) * binCount);
+  }
+  memcpy(frame + binCount, &trace.m_max[0], sizeof(float) * binCount);
+  memcpy(frame + 2 * binCount, &trace.m_min[0], sizeof(float) * binCount);
+  this->WriteFrame(step, sequenceId, trace.m_count, frame, sizeof(float) * 3 * binCount);
+  trace.m_count = 0;
+}
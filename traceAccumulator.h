@@ -0,0 +1,35 @@
+#pragma once
+
+#include "accumulator.h"
+
+// Average, max hold and min hold traces of the linear power per step. The
+// average is over the spectra since the last frame, or an exponentially
+// decaying average when decay is non zero. A frame with the three traces,
+// one after the other, is written for a step every frameCount spectra and
+// the max and min hold then start over.
+//
+class TraceAccumulator : public SpectrumAccumulator
+{
+  struct Trace
+  {
+    std::vector<float> m_average;
+    std::vector<float> m_max;
+    std::vector<float> m_min;
+    uint32_t m_count;
+    bool m_decayStarted;
+  };
+  std::vector<Trace> m_traces;
+  std::vector<float> m_frame;
+  std::vector<float> m_scratch;
+  uint32_t m_frameCount;
+  float m_decay;
+
+  void DoUpdate(uint32_t step, uint64_t sequenceId, const float * powers);
+
+ public:
+  TraceAccumulator(FrequencyTable * frequencyTable,
+                   const std::vector<StepSpectrum> & stepSpectra,
+                   std::string fileName,
+                   uint32_t frameCount,
+                   float decay);
+};